@@ -8,18 +8,55 @@ static void alloc_expr(struct expr *);
 
 static FILE *fout;
 static FILE *ferr;
+static const struct target *target;
+
+/* defined functions, allocated callees-first so that each call site
+   knows exactly which registers its callee clobbers */
+static struct decl **funcs;
+static int *func_state;
+static int num_funcs;
 
 void ast_alloc(struct prog *prog, struct config *cfg)
 {
 	fout = cfg->fout;
 	ferr = cfg->ferr;
+	target = cfg->target;
+	struct decl *d;
+	num_funcs = 0;
+	for (d = prog->ast; d; d = d->next) {
+		if (d->type->kind == TYPE_FUNCTION) {
+			d->symbol->clobbers = target->caller_saved;
+		}
+		++num_funcs;
+	}
+	funcs = malloc(num_funcs * sizeof(struct decl *));
+	func_state = calloc(num_funcs, sizeof(int));
+	num_funcs = 0;
+	for (d = prog->ast; d; d = d->next) {
+		if (d->type->kind == TYPE_FUNCTION && d->code) {
+			funcs[num_funcs++] = d;
+		}
+	}
 	alloc_decl(prog->ast);
+	free(funcs);
+	free(func_state);
 }
 
 static struct decl *func;
+static enum reg regs;
+static enum reg clobbered;
+static int trial;
+static int failed;
 
 static enum reg reg_alloc(void);
 static void reg_free(enum reg);
+static enum reg call_clobbers(struct expr *);
+static enum reg arg_regs(struct expr *);
+static void alloc_func(struct decl *);
+
+/* registers clobbered by calls made while the value being allocated
+   is still live */
+static enum reg across_call;
 
 void alloc_decl(struct decl *d)
 {
@@ -29,9 +66,8 @@ void alloc_decl(struct decl *d)
 	
 	switch (d->symbol->kind) {
 	case SYMBOL_GLOBAL:
-		if (d->type->kind == TYPE_FUNCTION) {
-			func = d;
-			alloc_stmt(d->code);
+		if (d->type->kind == TYPE_FUNCTION && d->code) {
+			alloc_func(d);
 		}
 		break;
 	case SYMBOL_PARAM:
@@ -54,6 +90,11 @@ void alloc_stmt(struct stmt *s)
 	}
 	
 	alloc_decl(s->decl);
+	if (s->kind == STMT_PRINT) {
+		/* only params are held between statements; the print saves those the runtime may clobber */
+		s->expr->live = regs & target->caller_saved;
+		clobbered |= target->caller_saved;
+	}
 	alloc_expr(s->expr);
 	if (s->expr && s->expr->reg > 0) {
 		reg_free(s->expr->reg);
@@ -69,8 +110,28 @@ void alloc_expr(struct expr *e)
 		return;
 	}
 	
+	/* the left operand (or arg) is held while the right side is evaluated,
+	   so it wants a callee-saved register if the right side makes a call */
+	enum reg hint = across_call;
+	across_call = hint | call_clobbers(e->right);
 	alloc_expr(e->left);
+	switch (e->kind) {
+	case EXPR_NOT:
+	case EXPR_POS:
+	case EXPR_NEG:
+	case EXPR_PRE_INCR:
+	case EXPR_PRE_DECR:
+	case EXPR_ASSIGN:
+	case EXPR_DIV:
+	case EXPR_MOD:
+		across_call = hint;
+		break;
+	default:
+		across_call = 0;
+		break;
+	}
 	alloc_expr(e->right);
+	across_call = hint;
 	
 	switch (e->kind) {
 	case EXPR_LE:
@@ -84,7 +145,14 @@ void alloc_expr(struct expr *e)
 	case EXPR_ADD:
 	case EXPR_SUB:
 	case EXPR_MUL:
+		e->reg = e->left->reg;
+		reg_free(e->right->reg);
+		break;
 	case EXPR_POW:
+		if (pow_calls(e)) {
+			e->live = regs & ~(e->left->reg | e->right->reg) & target->caller_saved;
+			clobbered |= target->caller_saved;
+		}
 		e->reg = e->left->reg;
 		reg_free(e->right->reg);
 		break;
@@ -95,12 +163,23 @@ void alloc_expr(struct expr *e)
 		break;
 	case EXPR_DIV:
 	case EXPR_MOD:
-		if (e->right->reg == REG_EDX) {
+		if (e->rule->result == NT_MODULO) {
+			e->reg = e->left->reg;
+			break;
+		}
+		e->live = regs & ~(e->left->reg | e->right->reg) & REG_EDX;
+		clobbered |= REG_EDX;
+		if (e->right->reg == REG_EDX || (!e->right->reg && e->left->reg != REG_EDX)) {
 			e->reg = e->left->reg;
 			reg_free(e->right->reg);
-		} else {		
+		} else if (e->right->reg) {
 			e->reg = e->right->reg;
 			reg_free(e->left->reg);
+		} else {
+			/* a constant divisor, and the result can't stay in %edx */
+			e->reg = reg_alloc();
+			func->regs |= e->reg;
+			reg_free(e->left->reg);
 		}
 		break;
 	case EXPR_PRE_INCR:
@@ -111,12 +190,22 @@ void alloc_expr(struct expr *e)
 	case EXPR_POST_DECR:
 		e->reg = e->left->reg;
 		break;
+	case EXPR_CALL:
+		e->live = regs & (e->symbol->clobbers | arg_regs(e));
+		clobbered |= e->symbol->clobbers | arg_regs(e);
+		e->reg = reg_alloc();
+		func->regs |= e->reg;
+		break;
 	case EXPR_INT:
 	case EXPR_CHAR:
 	case EXPR_BOOLEAN:
 	case EXPR_STRING:
 	case EXPR_NAME:
-	case EXPR_CALL:
+		/* immediates and memory operands need no register */
+		if (e->rule->result != NT_REG) {
+			e->reg = 0;
+			break;
+		}
 		e->reg = reg_alloc();
 		func->regs |= e->reg;
 		break;
@@ -131,39 +220,177 @@ void alloc_expr(struct expr *e)
 	}
 }
 
-static enum reg regs;
+enum reg call_clobbers(struct expr *e)
+{
+	if (!e) {
+		return 0;
+	}
+	
+	enum reg regs = call_clobbers(e->left) | call_clobbers(e->right);
+	switch (e->kind) {
+	case EXPR_CALL:
+		return regs | e->symbol->clobbers | arg_regs(e);
+	case EXPR_POW:
+		return pow_calls(e) ? regs | target->caller_saved : regs;
+	case EXPR_DIV:
+	case EXPR_MOD:
+		return regs | REG_EDX;
+	default:
+		return regs;
+	}
+}
 
+/* registers a call loads its args into */
+enum reg arg_regs(struct expr *e)
+{
+	enum reg regs = 0;
+	struct expr *arg;
+	int i = 0;
+	for (arg = e->right; arg; arg = arg->right) {
+		regs |= arg_reg(target, e->symbol, i++);
+	}
+	return regs;
+}
+
+static void alloc_callees(struct expr *);
+
+static void alloc_callees_stmt(struct stmt *s)
+{
+	if (!s) {
+		return;
+	}
+	
+	if (s->decl) {
+		alloc_callees(s->decl->value);
+	}
+	alloc_callees(s->expr);
+	alloc_callees_stmt(s->body);
+	alloc_callees_stmt(s->ebody);
+	alloc_callees_stmt(s->next);
+}
+
+void alloc_callees(struct expr *e)
+{
+	if (!e) {
+		return;
+	}
+	
+	alloc_callees(e->left);
+	alloc_callees(e->right);
+	if (e->kind == EXPR_CALL) {
+		int i;
+		for (i = 0; i < num_funcs; ++i) {
+			if (funcs[i]->symbol == e->symbol) {
+				alloc_func(funcs[i]);
+			}
+		}
+	}
+}
+
+static enum reg param_regs_expr(struct expr *e)
+{
+	if (!e) {
+		return 0;
+	}
+	
+	enum reg regs = param_regs_expr(e->left) | param_regs_expr(e->right);
+	if ((e->kind == EXPR_NAME || e->kind == EXPR_ASSIGN) && e->symbol->kind == SYMBOL_PARAM) {
+		regs |= arg_reg(target, func->symbol, e->symbol->offset);
+	}
+	return regs;
+}
+
+/* the arg registers of the params s and its successors refer to */
+static enum reg param_regs(struct stmt *s)
+{
+	if (!s) {
+		return 0;
+	}
+	
+	return (s->decl ? param_regs_expr(s->decl->value) : 0) |
+	       param_regs_expr(s->expr) |
+	       param_regs(s->body) |
+	       param_regs(s->ebody) |
+	       param_regs(s->next);
+}
+
+/* allocates func with its params held in the registers they arrive in; on trial, running
+   out of registers gives up instead of failing */
+static int alloc_params(enum reg params)
+{
+	func->param_regs = params;
+	func->regs = 0;
+	regs = params;
+	clobbered = 0;
+	trial = params != 0;
+	failed = 0;
+	alloc_stmt(func->code);
+	return !failed;
+}
+
+/* functions still being allocated (recursion) keep the conservative
+   summary every symbol starts with. params stay in their arg
+   registers for the whole body unless that leaves too few for the
+   expressions, in which case they are stored to the frame on entry */
+void alloc_func(struct decl *d)
+{
+	int i = 0;
+	while (funcs[i] != d) {
+		++i;
+	}
+	if (func_state[i]) {
+		return;
+	}
+	func_state[i] = 1;
+	alloc_callees_stmt(d->code);
+	func = d;
+	if (!alloc_params(param_regs(d->code))) {
+		alloc_params(0);
+	}
+	d->symbol->clobbers = clobbered | ((d->regs | d->param_regs) & target->caller_saved);
+	func_state[i] = 2;
+}
+
+/* free registers first, then callee-saved ones (saved once per
+   function), then scratch registers a call would clobber (saved around
+   every such call) */
 enum reg reg_alloc(void)
 {
-	enum reg reg;
-	for (reg = REG_EBX; reg < REG_EAX; reg *= 2) {
-		if (!(regs & reg)) {
-			regs |= reg;
-			return reg;
+	enum reg prefer[3];
+	prefer[0] = target->caller_saved & ~across_call;
+	prefer[1] = target->callee_saved;
+	prefer[2] = target->caller_saved & across_call;
+	int i, j;
+	for (i = 0; i < 3; ++i) {
+		for (j = 0; j < target->num_regs; ++j) {
+			enum reg reg = target->regs[j];
+			if ((prefer[i] & reg) && !(regs & reg)) {
+				regs |= reg;
+				return reg;
+			}
 		}
 	}
+	if (trial) {
+		failed = 1;
+		return 0;
+	}
 	fprintf(ferr, "alloc: cannot allocate register\n");
 	exit(1);
 }
 
 void reg_free(enum reg reg)
 {
-	switch (reg) {
-	case REG_EBX:
-	case REG_ECX:
-	case REG_EDX:
-	case REG_ESI:
-	case REG_EDI:
-		if (!(regs & reg)) {
-			fprintf(ferr, "alloc: attempted to free unallocated register '%s'\n", reg_to_s(reg));
-			exit(1);
-		}
-		regs ^= reg;
-		break;
-	case REG_EAX:
-	default:
+	if (!reg) {
+		return;
+	}
+	if (!(reg & (target->caller_saved | target->callee_saved)) ||
+	    (reg & (reg - 1))) {
 		fprintf(ferr, "alloc: attempted to free out-of-range register %d\n", reg);
 		exit(1);
-		break;
 	}
+	if (!(regs & reg)) {
+		fprintf(ferr, "alloc: attempted to free unallocated register '%s'\n", reg_to_s(reg));
+		exit(1);
+	}
+	regs ^= reg;
 }
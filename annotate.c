@@ -1,10 +1,13 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "ast.h"
 
 static void annotate_decl(struct decl *);
 static void annotate_stmt(struct stmt *);
 static void annotate_expr(struct expr *);
+static void chain_func(struct decl *);
+static void chain_stmt(struct stmt *, struct chain **reach);
 
 static FILE *fout;
 static int should_print;
@@ -49,8 +52,10 @@ void annotate_decl(struct decl *d)
 		return;
 	}
 	
+	chain_free(&d->uses);
 	annotate_stmt(d->code);
 	annotate_expr(d->value);	
+	chain_func(d);
 	annotate_decl(d->next);
 }
 
@@ -73,10 +78,15 @@ void annotate_expr(struct expr *e)
 		return;
 	}
 	
+	chain_free(&e->chain);
 	annotate_expr(e->left);
 	annotate_expr(e->right);
 	
 	switch (e->kind) {
+	case EXPR_NAME:
+		++e->symbol->num_reads;
+		annotate_print(e->symbol);
+		break;
 	case EXPR_ASSIGN:
 		++e->symbol->num_writes;
 		annotate_print(e->symbol);
@@ -87,25 +97,285 @@ void annotate_expr(struct expr *e)
 		break;
 	case EXPR_PRE_INCR:
 	case EXPR_PRE_DECR:
-		++e->right->symbol->num_reads;
+		/* the name below counted the read */
 		++e->right->symbol->num_writes;
 		annotate_print(e->right->symbol);
 		break;
 	case EXPR_POST_INCR:
 	case EXPR_POST_DECR:
-		++e->left->symbol->num_reads;
 		++e->left->symbol->num_writes;
 		annotate_print(e->left->symbol);
 		break;
 	default:
-		if (e->left && e->left->kind == EXPR_NAME) {
-			++e->left->symbol->num_reads;
-			annotate_print(e->left->symbol);
+		break;
+	}
+}
+
+/*
+the chains come from the stores reaching each point of a function, found forwards over its
+statements and going round a loop until what reaches its head settles. a store inside a larger
+expression may happen before or after any read in it, as evaluation order is left to the
+backend, so it reaches them all save those in its own value, and one under && or || may not
+happen at all.
+*/
+static int num_params;
+static int num_vars;
+static int linking;
+static struct chain **stores; /* those in the expression at hand */
+static char *maybe;
+
+static int var_index(struct symbol *s)
+{
+	switch (s->kind) {
+	case SYMBOL_PARAM:
+		return s->offset;
+	case SYMBOL_LOCAL:
+		return num_params + s->offset;
+	default:
+		return -1;
+	}
+}
+
+/* the variable e stores to, if a param or local */
+static int store_index(struct expr *e)
+{
+	switch (e->kind) {
+	case EXPR_ASSIGN:
+		return var_index(e->symbol);
+	case EXPR_PRE_INCR:
+	case EXPR_PRE_DECR:
+		return var_index(e->right->symbol);
+	case EXPR_POST_INCR:
+	case EXPR_POST_DECR:
+		return var_index(e->left->symbol);
+	default:
+		return -1;
+	}
+}
+
+static int defs_add(struct chain **cp, struct expr *e, struct decl *d)
+{
+	struct chain *c;
+	for (c = *cp; c; c = c->next) {
+		if (c->expr == e && c->decl == d) {
+			return 0;
+		}
+	}
+	c = malloc(sizeof(struct chain));
+	c->expr = e;
+	c->decl = d;
+	c->next = *cp;
+	*cp = c;
+	return 1;
+}
+
+static int defs_union(struct chain **cp, struct chain *from)
+{
+	int changed = 0;
+	for (; from; from = from->next) {
+		changed |= defs_add(cp, from->expr, from->decl);
+	}
+	return changed;
+}
+
+static struct chain **reach_copy(struct chain **reach)
+{
+	struct chain **copy = calloc(num_vars + 1, sizeof(struct chain *));
+	int i;
+	for (i = 0; i < num_vars; ++i) {
+		defs_union(&copy[i], reach[i]);
+	}
+	return copy;
+}
+
+static void reach_free(struct chain ***rp)
+{
+	int i;
+	for (i = 0; i < num_vars; ++i) {
+		chain_free(&(*rp)[i]);
+	}
+	free(*rp);
+	*rp = NULL;
+}
+
+static void collect(struct expr *e, int cond)
+{
+	int i;
+	if (!e) {
+		return;
+	}
+	collect(e->left, cond);
+	collect(e->right, cond || e->kind == EXPR_AND || e->kind == EXPR_OR);
+	if ((i = store_index(e)) >= 0) {
+		defs_add(&stores[i], e, NULL);
+		maybe[i] |= cond;
+	}
+}
+
+static int linked(struct expr *use, struct expr *e, struct decl *d)
+{
+	struct chain *c;
+	for (c = use->chain; c; c = c->next) {
+		if (c->expr == e && c->decl == d) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* within holds the stores e is part of the value of */
+static void link_reads(struct expr *e, struct chain **reach, struct chain *within)
+{
+	struct chain up, *c, *w;
+	int i;
+	if (!e) {
+		return;
+	}
+	up.expr = e;
+	up.decl = NULL;
+	up.next = within;
+	if (store_index(e) >= 0) {
+		within = &up;
+	}
+	link_reads(e->left, reach, within);
+	link_reads(e->right, reach, within);
+	if (e->kind != EXPR_NAME || (i = var_index(e->symbol)) < 0) {
+		return;
+	}
+	for (c = reach[i]; c; c = c->next) {
+		if (!linked(e, c->expr, c->decl)) {
+			chain_link(e, c->expr, c->decl);
 		}
-		if (e->right && e->right->kind == EXPR_NAME) {
-			++e->right->symbol->num_reads;
-			annotate_print(e->right->symbol);
+	}
+	for (c = stores[i]; c; c = c->next) {
+		for (w = within; w && w->expr != c->expr; w = w->next);
+		if (!w && !linked(e, c->expr, NULL)) {
+			chain_link(e, c->expr, NULL);
 		}
+	}
+}
+
+/* e is a whole expression; reach comes in as the stores reaching it and leaves as those after */
+static void chain_expr(struct expr *e, struct chain **reach)
+{
+	int i;
+	if (!e) {
 		return;
 	}
+	
+	collect(e, 0);
+	if (linking) {
+		link_reads(e, reach, NULL);
+	}
+	for (i = 0; i < num_vars; ++i) {
+		if (!stores[i]) {
+			continue;
+		}
+		if (!maybe[i]) {
+			chain_free(&reach[i]);
+		}
+		defs_union(&reach[i], stores[i]);
+		chain_free(&stores[i]);
+		maybe[i] = 0;
+	}
+	/* a store at the root comes last */
+	if ((i = store_index(e)) >= 0) {
+		chain_free(&reach[i]);
+		defs_add(&reach[i], e, NULL);
+	}
+}
+
+static void chain_while(struct stmt *s, struct chain **reach)
+{
+	struct chain **head = reach_copy(reach), **set;
+	int link = linking, changed = 1, i;
+	
+	/* the head is where the test runs, reached from before the loop and from the body's end */
+	linking = 0;
+	while (changed) {
+		set = reach_copy(head);
+		chain_expr(s->expr, set);
+		chain_stmt(s->body, set);
+		changed = 0;
+		for (i = 0; i < num_vars; ++i) {
+			changed |= defs_union(&head[i], set[i]);
+		}
+		reach_free(&set);
+	}
+	linking = link;
+	
+	chain_expr(s->expr, head);
+	for (i = 0; i < num_vars; ++i) {
+		chain_free(&reach[i]);
+		defs_union(&reach[i], head[i]);
+	}
+	chain_stmt(s->body, head);
+	reach_free(&head);
+}
+
+void chain_stmt(struct stmt *s, struct chain **reach)
+{
+	struct chain **set;
+	int i;
+	if (!s) {
+		return;
+	}
+	
+	switch (s->kind) {
+	case STMT_DECL:
+		chain_expr(s->decl->value, reach);
+		i = var_index(s->decl->symbol);
+		chain_free(&reach[i]);
+		defs_add(&reach[i], NULL, s->decl);
+		break;
+	case STMT_EXPR:
+	case STMT_PRINT:
+	case STMT_RETURN:
+		chain_expr(s->expr, reach);
+		break;
+	case STMT_IF_ELSE:
+		chain_expr(s->expr, reach);
+		set = reach_copy(reach);
+		chain_stmt(s->body, reach);
+		chain_stmt(s->ebody, set);
+		for (i = 0; i < num_vars; ++i) {
+			defs_union(&reach[i], set[i]);
+		}
+		reach_free(&set);
+		break;
+	case STMT_WHILE:
+		chain_while(s, reach);
+		break;
+	case STMT_BLOCK:
+		chain_stmt(s->body, reach);
+		break;
+	}
+	
+	chain_stmt(s->next, reach);
+}
+
+void chain_func(struct decl *d)
+{
+	struct param *p;
+	struct chain **reach;
+	int i;
+	if (d->type->kind != TYPE_FUNCTION || !d->code) {
+		return;
+	}
+	num_params = 0;
+	for (p = d->type->params; p; p = p->next) {
+		++num_params;
+	}
+	num_vars = num_params + d->num_locals;
+	reach = calloc(num_vars + 1, sizeof(struct chain *));
+	stores = calloc(num_vars + 1, sizeof(struct chain *));
+	maybe = calloc(num_vars + 1, 1);
+	for (i = 0; i < num_params; ++i) {
+		defs_add(&reach[i], NULL, NULL);
+	}
+	linking = 1;
+	chain_stmt(d->code, reach);
+	reach_free(&reach);
+	free(stores);
+	free(maybe);
 }
@@ -1,16 +1,20 @@
 #include <stdlib.h>
 #include <string.h>
 #include "ast.h"
+#include "ir.h"
 #include "hash_table.h"
 
 #define NEW(t) (malloc(sizeof(struct t)))
 
+static void chain_remove(struct chain **cp, struct expr *e, struct decl *d);
+
 struct prog *prog_make(struct decl *ast)
 {
 	struct prog *p = NEW(prog);
 	p->ast = ast;
 	p->strings = hash_table_create(0, 0);
 	p->symbols = NULL;
+	p->ir = NULL;
 	return p;
 }
 
@@ -29,12 +33,73 @@ void prog_free(struct prog **pp)
 	}
 	struct prog *p = *pp;
 	decl_free(&p->ast);
+	ir_free(&p->ir);
 	hash_table_delete(p->strings);
 	symbol_free(&p->symbols);
 	free(p);
 	*pp = 0;
 }
 
+void chain_link(struct expr *use, struct expr *def, struct decl *decl)
+{
+	struct chain *c = NEW(chain);
+	c->expr = def;
+	c->decl = decl;
+	c->next = use->chain;
+	use->chain = c;
+	if (!def && !decl) {
+		return;
+	}
+	c = NEW(chain);
+	c->expr = use;
+	c->decl = NULL;
+	if (def) {
+		c->next = def->chain;
+		def->chain = c;
+	} else {
+		c->next = decl->uses;
+		decl->uses = c;
+	}
+}
+
+void chain_remove(struct chain **cp, struct expr *e, struct decl *d)
+{
+	struct chain *c;
+	for (; *cp; cp = &(*cp)->next) {
+		if ((*cp)->expr == e && (*cp)->decl == d) {
+			c = *cp;
+			*cp = c->next;
+			free(c);
+			return;
+		}
+	}
+}
+
+void chain_free(struct chain **cp)
+{
+	struct chain *c, *next;
+	for (c = *cp; c; c = next) {
+		next = c->next;
+		free(c);
+	}
+	*cp = NULL;
+}
+
+/* whether prog is the whole program, so nothing outside it uses its globals */
+int prog_closed(struct prog *prog, struct config *cfg)
+{
+	struct decl *d;
+	if (cfg->flags & FLAG_KEEP_EXPORTS) {
+		return 0;
+	}
+	for (d = prog->ast; d; d = d->next) {
+		if (d->code && !strcmp(d->name, "main")) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
 const char *reg_to_s(enum reg reg)
 {
 	switch (reg) {
@@ -50,6 +115,22 @@ const char *reg_to_s(enum reg reg)
 		return "%esi";
 	case REG_EDI:
 		return "%edi";
+	case REG_R8:
+		return "%r8d";
+	case REG_R9:
+		return "%r9d";
+	case REG_R10:
+		return "%r10d";
+	case REG_R11:
+		return "%r11d";
+	case REG_R12:
+		return "%r12d";
+	case REG_R13:
+		return "%r13d";
+	case REG_R14:
+		return "%r14d";
+	case REG_R15:
+		return "%r15d";
 	default:
 		return NULL;
 	}
@@ -66,6 +147,8 @@ struct decl *decl_make(char *name, struct type *type, struct expr *value, struct
 	d->next = NULL;
 	d->num_locals = 0;
 	d->regs = 0;
+	d->param_regs = 0;
+	d->uses = NULL;
 	return d;
 }
 
@@ -75,6 +158,11 @@ void decl_free(struct decl **dp)
 		return;
 	}
 	struct decl *d = *dp;
+	struct chain *c;
+	for (c = d->uses; c; c = c->next) {
+		chain_remove(&c->expr->chain, NULL, d);
+	}
+	chain_free(&d->uses);
 	free(d->name);
 	type_free(&d->type);
 	expr_free(&d->value);
@@ -181,6 +269,9 @@ struct expr *expr_make(enum expr_kind kind, struct expr *left, struct expr *righ
 	e->constant = constant;
 	e->symbol = NULL;
 	e->reg = 0;
+	e->live = 0;
+	e->rule = NULL;
+	e->chain = NULL;
 	return e;
 }
 
@@ -190,6 +281,7 @@ struct expr *expr_copy(struct expr *e)
 		return NULL;
 	}
 	struct expr *copy = expr_make(e->kind, NULL, NULL, NULL, e->constant);
+	struct chain *c;
 	if (e->name) {
 		copy->name = malloc(strlen(e->name) + 1);
 		strcpy(copy->name, e->name);
@@ -197,6 +289,14 @@ struct expr *expr_copy(struct expr *e)
 	copy->left = expr_copy(e->left);
 	copy->right = expr_copy(e->right);
 	copy->symbol = e->symbol;
+	/* the copy reads or stores just where e does */
+	for (c = e->chain; c; c = c->next) {
+		if (e->kind == EXPR_NAME) {
+			chain_link(copy, c->expr, c->decl);
+		} else {
+			chain_link(c->expr, copy, NULL);
+		}
+	}
 	return copy;
 }
 
@@ -206,8 +306,17 @@ void expr_free(struct expr **ep)
 		return;
 	}
 	struct expr *e = *ep;
+	struct chain *c;
 	expr_free(&e->left);
 	expr_free(&e->right);
+	for (c = e->chain; c; c = c->next) {
+		if (c->expr) {
+			chain_remove(&c->expr->chain, e, NULL);
+		} else if (c->decl) {
+			chain_remove(&c->decl->uses, e, NULL);
+		}
+	}
+	chain_free(&e->chain);
 	free(e->name);
 	free(e);
 	*ep = 0;
@@ -294,8 +403,10 @@ int expr_has_effects(struct expr *e)
 	case EXPR_CHAR:
 	case EXPR_STRING:
 		return 0;
-	case EXPR_ASSIGN:
 	case EXPR_CALL:
+		/* a pure call that would never return goes if its value is unused */
+		return !e->symbol->pure || expr_has_effects(e->right);
+	case EXPR_ASSIGN:
 	case EXPR_PRE_INCR:
 	case EXPR_PRE_DECR:
 	case EXPR_POST_INCR:
@@ -306,6 +417,26 @@ int expr_has_effects(struct expr *e)
 	}
 }
 
+/* x ^ y by repeated squaring, wrapping like the generated code; 1 for y <= 0 */
+int power(int x, int y)
+{
+	unsigned result = 1, base = x;
+	while (y > 0) {
+		if (y & 1) {
+			result *= base;
+		}
+		base *= base;
+		y >>= 1;
+	}
+	return result;
+}
+
+/* whether x ^ y calls power() at runtime rather than multiplying inline */
+int pow_calls(struct expr *e)
+{
+	return e->right->kind != EXPR_INT || e->right->constant > POW_INLINE_MAX;
+}
+
 struct stmt *stmt_make(enum stmt_kind kind, struct decl *decl, struct expr *expr, struct stmt *body, struct stmt *ebody)
 {
 	struct stmt *s = NEW(stmt);
@@ -333,6 +464,118 @@ void stmt_free(struct stmt **sp)
 	*sp = 0;
 }
 
+static enum reg expr_regs(struct expr *e, int live)
+{
+	if (!e) {
+		return 0;
+	}
+	
+	return (live ? e->live : e->reg) |
+	       expr_regs(e->left, live) |
+	       expr_regs(e->right, live);
+}
+
+static enum reg decl_regs(struct decl *d, int live)
+{
+	if (!d) {
+		return 0;
+	}
+	
+	return expr_regs(d->value, live) | decl_regs(d->next, live);
+}
+
+/* registers clobbered (or, with live set, saved) by s and its
+   substatements, but not s->next */
+enum reg stmt_regs(struct stmt *s, int live)
+{
+	if (!s) {
+		return 0;
+	}
+	
+	enum reg regs = decl_regs(s->decl, live) | expr_regs(s->expr, live);
+	struct stmt *t;
+	for (t = s->body; t; t = t->next) {
+		regs |= stmt_regs(t, live);
+	}
+	for (t = s->ebody; t; t = t->next) {
+		regs |= stmt_regs(t, live);
+	}
+	return regs;
+}
+
+static int expr_calls(struct expr *e)
+{
+	if (!e) {
+		return 0;
+	}
+	
+	switch (e->kind) {
+	case EXPR_CALL:
+		return 1;
+	case EXPR_POW:
+		return pow_calls(e) || expr_calls(e->left);
+	default:
+		return expr_calls(e->left) || expr_calls(e->right);
+	}
+}
+
+/* whether s or anything after it calls out (including the runtime) */
+int stmt_calls(struct stmt *s)
+{
+	if (!s) {
+		return 0;
+	}
+	
+	return s->kind == STMT_PRINT ||
+	       (s->decl && expr_calls(s->decl->value)) ||
+	       expr_calls(s->expr) ||
+	       stmt_calls(s->body) ||
+	       stmt_calls(s->ebody) ||
+	       stmt_calls(s->next);
+}
+
+static int max(int a, int b)
+{
+	return a > b ? a : b;
+}
+
+static int expr_args(struct expr *e)
+{
+	if (!e) {
+		return 0;
+	}
+	
+	int args = max(expr_args(e->left), expr_args(e->right));
+	struct expr *arg;
+	int arity = 0;
+	switch (e->kind) {
+	case EXPR_CALL:
+		for (arg = e->right; arg; arg = arg->right) {
+			++arity;
+		}
+		return max(args, arity);
+	case EXPR_POW:
+		return pow_calls(e) ? max(args, 2) : args;
+	default:
+		return args;
+	}
+}
+
+/* words of outgoing args needed by the calls in s and after it */
+int stmt_args(struct stmt *s)
+{
+	if (!s) {
+		return 0;
+	}
+	
+	int args = s->kind == STMT_PRINT ? 1 : 0;
+	args = max(args, s->decl ? expr_args(s->decl->value) : 0);
+	args = max(args, expr_args(s->expr));
+	args = max(args, stmt_args(s->body));
+	args = max(args, stmt_args(s->ebody));
+	return max(args, stmt_args(s->next));
+}
+
 struct symbol *symbol_make(enum symbol_kind kind, struct type *type, char *name, struct prog *prog)
 {
 	struct symbol *s = NEW(symbol);
@@ -345,6 +588,9 @@ struct symbol *symbol_make(enum symbol_kind kind, struct type *type, char *name,
 	s->value = NULL;
 	s->num_reads = 0;
 	s->num_writes = 0;
+	s->clobbers = 0;
+	s->pure = 0;
+	s->internal = 0;
 	if (prog) {
 		s->next = prog->symbols;
 		prog->symbols = s;
@@ -3,15 +3,20 @@
 #include <stdio.h>
 #include "hash_table.h"
 
+struct ir_func;
+struct config;
+
 struct prog {
 	struct decl *ast;
 	struct hash_table *strings;
 	struct symbol *symbols;
+	struct ir_func *ir; /* built by ir_lower */
 };
 
 extern struct prog *prog_make(struct decl *ast);
 extern void prog_add_string(struct prog *prog, const char *string);
 extern void prog_free(struct prog **pp);
+extern int prog_closed(struct prog *prog, struct config *cfg);
 
 enum reg {
 	REG_EBX = 1,
@@ -19,11 +24,40 @@ enum reg {
 	REG_EDX = 4,
 	REG_ESI = 8,
 	REG_EDI = 16,
-	REG_EAX = 32
+	REG_EAX = 32,
+	/* x86-64 only; the registers above double as their 64-bit forms */
+	REG_R8 = 64,
+	REG_R9 = 128,
+	REG_R10 = 256,
+	REG_R11 = 512,
+	REG_R12 = 1024,
+	REG_R13 = 2048,
+	REG_R14 = 4096,
+	REG_R15 = 8192
 };
 
+/* i386 convention: callers preserve these across calls... */
+#define REG_CALLER_SAVED (REG_ECX | REG_EDX)
+/* ...and callees preserve these if they clobber them */
+#define REG_CALLEE_SAVED (REG_EBX | REG_ESI | REG_EDI)
+
 extern const char *reg_to_s(enum reg);
 
+/* a link in the def-use and use-def chains ast_annotate builds over params
+   and locals: a read links to each store that may reach it, and a store to
+   each read it may reach. a store is an assign, a step or a decl; a read's
+   link with neither is a param's value on entry. expr_copy and expr_free
+   keep both ends in step, so a rewrite that only copies and frees nodes
+   leaves the chains right. inline and promote link the code they build */
+struct chain {
+	struct expr *expr;
+	struct decl *decl;
+	struct chain *next;
+};
+
+extern void chain_link(struct expr *use, struct expr *def, struct decl *decl);
+extern void chain_free(struct chain **cp);
+
 struct decl {
 	char *name;
 	struct type *type;
@@ -33,6 +67,8 @@ struct decl {
 	struct decl *next;
 	int num_locals;
 	enum reg regs;
+	enum reg param_regs; /* for functions, the arg registers params are kept in */
+	struct chain *uses; /* the reads a local's initializer reaches */
 };
 
 extern struct decl *decl_make(char *name, struct type *type, struct expr *value, struct stmt *code);
@@ -101,6 +137,9 @@ struct expr {
 	int constant;
 	struct symbol *symbol;
 	enum reg reg;
+	enum reg live; /* registers to preserve around this node */
+	const struct rule *rule; /* chosen by ast_select */
+	struct chain *chain; /* a read's stores, or a store's reads */
 };
 
 extern struct expr *expr_make(enum expr_kind kind, struct expr *left, struct expr *right, char *name, int constant);
@@ -109,6 +148,10 @@ extern void expr_free(struct expr **ep);
 extern enum type_kind expr_to_type_kind(struct expr *e);
 extern int expr_is_const(struct expr *e);
 extern int expr_has_effects(struct expr *e);
+extern int power(int x, int y);
+/* constant exponents up to this take at most 12 multiplies inline */
+#define POW_INLINE_MAX 64
+extern int pow_calls(struct expr *e);
 
 enum stmt_kind {
 	STMT_DECL,
@@ -131,6 +174,9 @@ struct stmt {
 
 extern struct stmt *stmt_make(enum stmt_kind kind, struct decl *decl, struct expr *expr, struct stmt *body, struct stmt *ebody);
 extern void stmt_free(struct stmt **sp);
+extern enum reg stmt_regs(struct stmt *s, int live);
+extern int stmt_calls(struct stmt *s);
+extern int stmt_args(struct stmt *s);
 
 enum symbol_kind {
 	SYMBOL_GLOBAL,
@@ -148,6 +194,9 @@ struct symbol {
 	struct expr *value;
 	int num_reads;
 	int num_writes;
+	enum reg clobbers; /* for functions, registers a call may change */
+	int pure; /* for functions, no prints or global stores, found by ast_reduce */
+	int internal; /* for functions, defined here and called from nowhere else */
 	struct symbol *next;
 };
 
@@ -165,7 +214,10 @@ extern void param_free(struct param **pp);
 
 enum config_flag {
 	FLAG_PRINT_RESOLVE = 1,
-	FLAG_PRINT_ANNOTATE = 2
+	FLAG_PRINT_ANNOTATE = 2,
+	FLAG_OMIT_FRAME_POINTER = 4,
+	FLAG_IR = 8,
+	FLAG_KEEP_EXPORTS = 16
 };
 
 struct config {
@@ -173,6 +225,7 @@ struct config {
 	FILE *ferr;
 	int opt_level;
 	enum config_flag flags;
+	const struct target *target;
 };
 
 typedef void (*ast_pass)(struct prog *, struct config *);
@@ -181,9 +234,91 @@ extern void ast_resolve(struct prog *prog, struct config *cfg);
 extern void ast_typecheck(struct prog *prog, struct config *cfg);
 extern void ast_canon(struct prog *prog, struct config *cfg);
 extern void ast_reduce(struct prog *prog, struct config *cfg);
+extern void eval_begin(struct prog *prog);
+extern int eval_call(struct expr *e, int *value);
+extern void eval_end(void);
 extern void ast_annotate(struct prog *prog, struct config *cfg);
 extern void ast_inline(struct prog *prog, struct config *cfg);
 extern void ast_prune(struct prog *prog, struct config *cfg);
+extern void ast_promote(struct prog *prog, struct config *cfg);
+extern void ast_frame(struct prog *prog, struct config *cfg);
+extern void ast_select(struct prog *prog, struct config *cfg);
 extern void ast_alloc(struct prog *prog, struct config *cfg);
 extern void ast_codegen(struct prog *prog, struct config *cfg);
+
+/* what the allocator and the code generators need to know about a machine */
+struct target {
+	const char *name;
+	const enum reg *regs; /* allocatable, scratch registers first */
+	int num_regs;
+	enum reg caller_saved;
+	enum reg callee_saved;
+	const enum reg *arg_regs;
+	int num_arg_regs;
+	int local_args; /* only internal functions take arg_regs */
+};
+
+extern const struct target target_i386;
+extern const struct target target_x86_64;
+extern const struct target *target_from_s(const char *name);
+extern enum reg arg_reg(const struct target *target, struct symbol *func, int i);
+
+/* unsigned division by a constant d as q = hi(n * mul) >> shift, or when
+   mul needs 33 bits, t = hi(n * mul) and q = (t + (n - t) / 2) >> shift */
+struct div_magic {
+	unsigned mul;
+	int add;
+	int shift;
+};
+
+extern int log2_exact(unsigned c);
+extern void div_magic(unsigned d, struct div_magic *m);
+extern unsigned mod_inverse(unsigned d);
+
+/* what an expression reduces to for the instruction that consumes it */
+enum nonterm {
+	NT_NONE,   /* no subtree */
+	NT_REG,    /* a value in a register */
+	NT_IMM,    /* a constant the consumer takes as an immediate */
+	NT_MEM,    /* a variable the consumer reads from memory */
+	NT_INDEX,  /* x * 2, 4 or 8 as the index of a lea */
+	NT_MODULO, /* x % d, tested against zero without dividing */
+	NT_UPDATE, /* x + y or x - y done in place, for x = x + y */
+	NT_VOID,   /* evaluated for effect */
+	NT_PRINT,  /* print args */
+	NUM_NONTERMS
+};
+
+/* a tree pattern: kind with its children reduced to left and right
+   gives result; tmpl, if not NULL, is the instruction to emit, with the
+   backend lowering the node itself otherwise */
+struct rule {
+	enum expr_kind kind;
+	enum nonterm result;
+	enum nonterm left;
+	enum nonterm right;
+	int cost;
+	int (*when)(struct expr *);
+	const char *tmpl;
+};
+
+enum insn_kind {
+	INSN_LABEL,
+	INSN_OP,
+	INSN_RAW
+};
+
+/* one line of generated assembly, buffered per function for the peephole pass */
+struct insn {
+	enum insn_kind kind;
+	char *op; /* label name, opcode or the verbatim line */
+	char *args[3];
+	int num_args;
+	struct insn *next;
+};
+
+extern struct insn *insn_make(const char *line);
+extern void insn_print(FILE *f, struct insn *i);
+extern void insn_free(struct insn **ip);
+extern struct insn *peephole(struct insn *list, const struct target *target, struct decl *summaries);
 #endif
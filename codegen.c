@@ -12,21 +12,52 @@ static void codegen_expr(struct expr *);
 static struct hash_table *strings;
 static FILE *fout;
 static FILE *ferr;
+static const struct target *target;
+static int x64;
+static int word;
+static int omit_frame_pointer;
+
+/* the function being generated, kept until its peephole pass */
+static struct insn *insns;
+static struct insn **insns_tail;
+/* the program's functions, whose clobber summaries alloc worked out */
+static struct decl *summaries;
 
 static void write(const char *fmt, ...)
 {
+	char line[256];
 	va_list argp;
 	va_start(argp, fmt);
-	vfprintf(fout, fmt, argp);
-	fputc('\n', fout);
+	vsnprintf(line, sizeof(line), fmt, argp);
 	va_end(argp);
+	if (insns_tail) {
+		*insns_tail = insn_make(line);
+		insns_tail = &(*insns_tail)->next;
+	} else {
+		fprintf(fout, "%s\n", line);
+	}
+}
+
+static void flush(void)
+{
+	insns_tail = NULL;
+	insns = peephole(insns, target, summaries);
+	insn_print(fout, insns);
+	insn_free(&insns);
 }
 
+/* both targets come through here: x86-64 differs in its register
+   names, its 8 byte strings and slots, and passing args in registers */
 void ast_codegen(struct prog *prog, struct config *cfg)
 {
 	strings = prog->strings;
+	summaries = prog->ast;
 	fout = cfg->fout;
 	ferr = cfg->ferr;
+	target = cfg->target;
+	x64 = target == &target_x86_64;
+	word = x64 ? 8 : 4;
+	omit_frame_pointer = cfg->flags & FLAG_OMIT_FRAME_POINTER;
 	write("\t.text");
 	char *s;
 	int *ip;
@@ -38,11 +69,116 @@ void ast_codegen(struct prog *prog, struct config *cfg)
 	codegen_decl(prog->ast);
 }
 
-static char *func_name;
+static struct decl *func;
+static const char *reg_to_q(enum reg);
+static const char *reg_to_b(enum reg);
+static const char *reg_of(enum reg, int wide);
+static const char *cmp_cc(enum expr_kind, int sense);
+static void codegen_jump(struct expr *, int sense, const char *target);
+static void codegen_setcc(struct expr *);
+static void codegen_cmp(struct expr *);
+static void codegen_logical(struct expr *);
+static struct expr *divisibility(struct expr *);
+static const char *codegen_divisible(struct expr *, int sense);
+static void codegen_divconst(struct expr *);
+static void codegen_mulconst(struct expr *);
+static void codegen_powconst(struct expr *);
+static void operand(char *buffer, struct expr *, int wide);
+static void emit(struct expr *);
+static int skip_count;
+static void frame_loc(char *buffer, int offset);
+static void param_loc(char *buffer, int i);
 static void loc_from_symbol(char *buffer, struct symbol *);
+static void runtime_arg(char *buffer, int i, int wide);
+static void codegen_args(struct expr *);
+static void parallel_move(enum reg *from, enum reg *to, int n);
+static void save_regs(enum reg);
+static void restore_regs(enum reg);
+
+/* strings are pointers; everything else is a 32-bit int that lives in
+   the low half of a register or slot */
+#define WIDE(e) (x64 && expr_to_type_kind(e) == TYPE_STRING)
+#define MOV(wide) ((wide) ? "movq" : "movl")
+#define SUFFIX (x64 ? 'q' : 'l')
+#define SP (x64 ? "%rsp" : "%esp")
+#define FP (x64 ? "%rbp" : "%ebp")
+
+/*
+the stack pointer never moves between prologue and epilogue: registers are saved to fixed slots
+and outgoing args are stored into an area at the bottom of the frame, so without a frame pointer
+params and locals sit at constant offsets from it. params arriving in registers (the first six
+on x86-64, the first two of an internal function on i386) stay there unless alloc had to give
+their registers up; then they are homed on entry, on i386 into their slots among the caller's
+args. the rest sit above the return address. %rsp is 16-byte aligned at every call, and x86-64
+leaf functions keep a small frame in the red zone and never move it at all.
+
+frame, from the top: homed x86-64 register params, locals, one save slot per register saved
+anywhere, outgoing stack args.
+*/
+static int use_sp;
+static int red_zone;
+static int frame_size;
+static int out_size;
+static int locals_base;
+static int params_base;
+static enum reg save_set;
 
-#define MAYBE_PUSH(r) if (d->regs & r) write("\tpushl\t%s", reg_to_s(r))
-#define MAYBE_POP(r) if (d->regs & r) write("\tpopl\t%s", reg_to_s(r))
+/* callee-saved registers are saved just before the first top-level
+   statement that clobbers one and restored after the last, so early
+   returns outside that region skip the saves */
+static struct stmt *wrap_first;
+static struct stmt *wrap_last;
+static enum reg wrap_regs;
+static enum reg saved_regs;
+
+static void shrink_wrap(struct decl *d)
+{
+	struct stmt *s = d->code->kind == STMT_BLOCK ? d->code->body : d->code;
+	wrap_first = wrap_last = NULL;
+	wrap_regs = d->regs & target->callee_saved;
+	saved_regs = 0;
+	if (!wrap_regs) {
+		return;
+	}
+	while (s) {
+		if (stmt_regs(s, 0) & wrap_regs) {
+			if (!wrap_first) {
+				wrap_first = s;
+			}
+			wrap_last = s;
+		}
+		s = s->next;
+	}
+}
+
+static void frame_layout(struct decl *d)
+{
+	struct param *p;
+	int i, num_homes = 0, calls = stmt_calls(d->code);
+	for (p = d->type->params, i = 0; p; p = p->next, ++i) {
+		if (x64 && arg_reg(target, d->symbol, i) && !(arg_reg(target, d->symbol, i) & d->param_regs)) {
+			num_homes = i + 1;
+		}
+	}
+	out_size = stmt_args(d->code) - (x64 ? target->num_arg_regs : 0);
+	out_size = out_size > 0 ? out_size * word : 0;
+	save_set = wrap_regs | stmt_regs(d->code, 1);
+	locals_base = out_size;
+	for (i = 0; i < target->num_regs; ++i) {
+		if (save_set & target->regs[i]) {
+			locals_base += word;
+		}
+	}
+	params_base = locals_base + d->num_locals * word;
+	frame_size = params_base + num_homes * word;
+	/* leaf functions never need a frame pointer */
+	use_sp = omit_frame_pointer || !calls;
+	red_zone = x64 && !calls && frame_size <= 128;
+	/* the return address (and saved %rbp) count toward alignment */
+	if (x64 && calls && (frame_size + (use_sp ? 8 : 16)) % 16) {
+		frame_size += 8;
+	}
+}
 
 void codegen_decl(struct decl *d)
 {
@@ -50,7 +186,9 @@ void codegen_decl(struct decl *d)
 		return;
 	}
 	
-	char buffer[16];
+	char buffer[32], value[256];
+	struct param *p;
+	int i;
 	switch (d->symbol->kind) {
 	case SYMBOL_GLOBAL:
 		switch (d->type->kind) {
@@ -59,32 +197,46 @@ void codegen_decl(struct decl *d)
 				break;
 			}
 			write("\t.text");
+			insns_tail = &insns;
 			write(".globl %s", d->name);
 			write("%s:", d->name);
-			write("\tpushl\t%%ebp");
-			write("\tmovl\t%%esp, %%ebp");
-			if (d->num_locals > 0) {
-				write("\tsubl\t$%d, %%esp", d->num_locals * 4);
+			func = d;
+			shrink_wrap(d);
+			frame_layout(d);
+			if (!use_sp) {
+				write("\tpush%c\t%s", SUFFIX, FP);
+				write("\tmov%c\t%s, %s", SUFFIX, SP, FP);
+			}
+			if (frame_size > 0 && !red_zone) {
+				write("\tsub%c\t$%d, %s", SUFFIX, frame_size, SP);
+			}
+			for (p = d->type->params, i = 0; p && arg_reg(target, d->symbol, i); p = p->next, ++i) {
+				if (!(arg_reg(target, d->symbol, i) & d->param_regs)) {
+					param_loc(buffer, i);
+					write("\tmov%c\t%s, %s", SUFFIX, reg_of(arg_reg(target, d->symbol, i), x64), buffer);
+				}
 			}
-			MAYBE_PUSH(REG_EBX);
-			MAYBE_PUSH(REG_ECX);
-			MAYBE_PUSH(REG_EDX);
-			MAYBE_PUSH(REG_ESI);
-			MAYBE_PUSH(REG_EDI);
-			func_name = d->name;
 			codegen_stmt(d->code);
 			write("\tmovl\t$0, %%eax");
+			if (wrap_regs && !saved_regs) {
+				write("\tjmp\t.%sleave", d->name);
+			}
 			write(".%sret:", d->name);
-			MAYBE_POP(REG_EDI);
-			MAYBE_POP(REG_ESI);
-			MAYBE_POP(REG_EDX);
-			MAYBE_POP(REG_ECX);
-			MAYBE_POP(REG_EBX);
-			write("\tleave");
+			restore_regs(wrap_regs);
+			write(".%sleave:", d->name);
+			if (!use_sp) {
+				write("\tleave");
+			} else if (frame_size > 0 && !red_zone) {
+				write("\tadd%c\t$%d, %s", SUFFIX, frame_size, SP);
+			}
 			write("\tret");
+			flush();
 			break;
 		default:
 			write("\t.data");
+			if (x64 && d->type->kind == TYPE_STRING) {
+				write("\t.align\t8");
+			}
 			write(".globl %s", d->name);
 			write("%s:", d->name);
 			if (d->value) {
@@ -97,19 +249,19 @@ void codegen_decl(struct decl *d)
 			} else {
 				strcpy(buffer, "0");
 			}
-			write("\t.long\t%s", buffer);
+			write("\t.%s\t%s", x64 && d->type->kind == TYPE_STRING ? "quad" : "long", buffer);
 			break;
 		}
 		break;
 	case SYMBOL_PARAM:
 		break;
 	case SYMBOL_LOCAL:
-		loc_from_symbol(buffer, d->symbol);
+		/* canon gives every local a value, so one without had a dead one pruned */
 		if (d->value) {
 			codegen_expr(d->value);
-			write("\tmovl\t%s, %s", reg_to_s(d->value->reg), buffer);
-		} else {
-			write("\tmovl\t$0, %s", buffer);
+			operand(value, d->value, WIDE(d->value));
+			loc_from_symbol(buffer, d->symbol);
+			write("\t%s\t%s, %s", MOV(WIDE(d->value)), value, buffer);
 		}
 		break;
 	}
@@ -126,6 +278,12 @@ void codegen_stmt(struct stmt *s)
 	static int label_count = 0;
 	int label = ++label_count;
 	struct expr *e = s->expr;
+	char target[32], value[256], arg[32];
+	int wide, saved;
+	if (s == wrap_first) {
+		save_regs(wrap_regs);
+		saved_regs = wrap_regs;
+	}
 	switch (s->kind) {
 	case STMT_DECL:
 		codegen_decl(s->decl);
@@ -135,9 +293,8 @@ void codegen_stmt(struct stmt *s)
 		break;
 	case STMT_IF_ELSE:
 		write(".if%d:", label);
-		codegen_expr(e);
-		write("\tcmpl\t$0, %s", reg_to_s(e->reg));
-		write("\tje\t.else%d", label);
+		sprintf(target, ".else%d", label);
+		codegen_jump(e, 0, target);
 		write(".then%d:", label);
 		codegen_stmt(s->body);
 		write("\tjmp\t.endif%d", label);
@@ -146,59 +303,67 @@ void codegen_stmt(struct stmt *s)
 		write(".endif%d:", label);
 		break;
 	case STMT_WHILE:
-		write(".while%d:", label);
-		codegen_expr(e);
-		write("\tcmpl\t$0, %s", reg_to_s(e->reg));
-		write("\tje\t.endwhile%d", label);
+		/* the test sits at the bottom so each iteration takes one branch */
+		write("\tjmp\t.while%d", label);
 		write(".whilebody%d:", label);
 		codegen_stmt(s->body);
-		write("\tjmp\t.while%d", label);
+		write(".while%d:", label);
+		sprintf(target, ".whilebody%d", label);
+		codegen_jump(e, 1, target);
 		write(".endwhile%d:", label);
 		break;
 	case STMT_RETURN:
 		codegen_expr(e);
-		write("\tmovl\t%s, %%eax", reg_to_s(e->reg));
-		write("\tjmp\t.%sret", func_name);
+		wide = WIDE(e);
+		operand(value, e, wide);
+		write("\t%s\t%s, %s", MOV(wide), value, reg_of(REG_EAX, wide));
+		write("\tjmp\t.%s%s", func->name, saved_regs ? "ret" : "leave");
 		break;
 	case STMT_BLOCK:
 		codegen_stmt(s->body);
 		break;
 	case STMT_PRINT:
+		/* params the runtime may clobber are saved ahead of the first call and restored after
+		   each; an arg that may store to one has them saved again */
+		saved = 0;
 		while (e) {
 			codegen_expr(e->left);
-			write("\tpushl\t%s", reg_to_s(e->left->reg));
+			wide = WIDE(e->left);
+			operand(value, e->left, wide);
+			if (!saved || expr_has_effects(e->left)) {
+				save_regs(s->expr->live);
+				saved = 1;
+			}
+			runtime_arg(arg, 0, wide);
+			write("\t%s\t%s, %s", MOV(wide), value, arg);
 			write("\tcall\tprint_%s", type_kind_to_s(expr_to_type_kind(e->left)));
-			write("\taddl\t$4, %%esp");
+			restore_regs(s->expr->live);
 			e = e->right;
 		}
-		write("\tpushl\t$10");
+		runtime_arg(arg, 0, 0);
+		write("\tmovl\t$10, %s", arg);
 		write("\tcall\tprint_char");
-		write("\taddl\t$4, %%esp");
+		restore_regs(s->expr->live);
 		break;
 	}
+	if (s == wrap_last && s->kind != STMT_RETURN) {
+		restore_regs(wrap_regs);
+		saved_regs = 0;
+	}
 	
 	codegen_stmt(s->next);
 }
 
-/* this could maybe be a function... */
-#define CODEGEN_CMP(op) do { \
-	write(".cmp%d:", label); \
-	write("\tcmpl\t%s, %s", reg_to_s(e->right->reg), reg_to_s(e->left->reg)); \
-	write("\t" op "\t.true%d", label); \
-	write(".false%d:", label); \
-	write("\tmovl\t$0, %s", reg_to_s(e->reg)); \
-	write("\tjmp\t.endcmp%d", label); \
-	write(".true%d:", label); \
-	write("\tmovl\t$1, %s", reg_to_s(e->reg)); \
-	write(".endcmp%d:", label); } while (0)
 #define CODEGEN_DIV(dest) do { \
+	save_regs(e->live); \
 	write("\tmovl\t%s, %%eax", reg_to_s(e->left->reg)); \
 	if (e->right->reg != e->reg) { \
 		write("\tmovl\t%s, %s", reg_to_s(e->right->reg), reg_to_s(e->reg)); \
 	} \
 	write("\tmovl\t$0, %%edx"); \
 	write("\tidivl\t%s", reg_to_s(e->reg)); \
-	write("\tmovl\t%%" dest ", %s", reg_to_s(e->reg)); } while (0)
+	write("\tmovl\t%%" dest ", %s", reg_to_s(e->reg)); \
+	restore_regs(e->live); } while (0)
 
 void codegen_expr(struct expr *e)
 {
@@ -206,39 +371,62 @@ void codegen_expr(struct expr *e)
 		return;
 	}
 	
+	/* operands are folded into the instruction that consumes them, and
+	   an index only needs its register */
+	if (e->rule->result == NT_IMM || e->rule->result == NT_MEM) {
+		return;
+	} else if (e->rule->result == NT_INDEX) {
+		codegen_expr(e->left);
+		return;
+	} else if (e->rule->tmpl) {
+		codegen_expr(e->left);
+		codegen_expr(e->right);
+		emit(e);
+		return;
+	}
+	
+	/* these evaluate their operands themselves */
+	if (e->kind == EXPR_AND || e->kind == EXPR_OR) {
+		codegen_logical(e);
+		return;
+	} else if (divisibility(e)) {
+		write("\tset%s\t%s", codegen_divisible(e, 1), reg_to_b(e->reg));
+		write("\tmovzbl\t%s, %s", reg_to_b(e->reg), reg_to_s(e->reg));
+		return;
+	} else if ((e->kind == EXPR_DIV || e->kind == EXPR_MOD) && e->right->rule->result == NT_IMM) {
+		codegen_divconst(e);
+		return;
+	} else if (e->kind == EXPR_MUL && e->right->rule->result == NT_IMM) {
+		codegen_mulconst(e);
+		return;
+	} else if (e->kind == EXPR_POW && e->right->rule->result == NT_IMM) {
+		codegen_powconst(e);
+		return;
+	}
+	
+	/* caller-saved registers must be saved before any args */
+	if (e->kind == EXPR_CALL) {
+		save_regs(e->live);
+	}
 	codegen_expr(e->left);
 	codegen_expr(e->right);
 	
-	//write("%d", e->kind);
-	
-	static int label_count = 0;
-	int label = ++label_count;
-	char location[16];
+	char location[32];
 	int *ip;
+	int wide = WIDE(e);
+	enum reg from[2], to[2];
 	switch (e->kind) {
 	case EXPR_LE:
-		CODEGEN_CMP("jle");
-		break;
 	case EXPR_LT:
-		CODEGEN_CMP("jl");
-		break;
 	case EXPR_EQ:
-		CODEGEN_CMP("je");
-		break;
 	case EXPR_NE:
-		CODEGEN_CMP("jne");
-		break;
 	case EXPR_GT:
-		CODEGEN_CMP("jg");
-		break;
 	case EXPR_GE:
-		CODEGEN_CMP("jge");
-		break;	
-	case EXPR_AND:
-		write("\tandl\t%s, %s", reg_to_s(e->right->reg), reg_to_s(e->left->reg));
+		codegen_setcc(e);
 		break;
+	case EXPR_AND:
 	case EXPR_OR:
-		write("\torl\t%s, %s", reg_to_s(e->right->reg), reg_to_s(e->left->reg));
+		/* handled by codegen_logical */
 		break;
 	case EXPR_NOT:
 		write("\txorl\t$1, %s", reg_to_s(e->right->reg));
@@ -264,11 +452,20 @@ void codegen_expr(struct expr *e)
 		CODEGEN_DIV("edx");
 		break;
 	case EXPR_POW:
-		write("\tpushl\t%s", reg_to_s(e->right->reg));
-		write("\tpushl\t%s", reg_to_s(e->left->reg));
+		save_regs(e->live);
+		if (x64) {
+			from[0] = e->left->reg;
+			from[1] = e->right->reg;
+			to[0] = target->arg_regs[0];
+			to[1] = target->arg_regs[1];
+			parallel_move(from, to, 2);
+		} else {
+			write("\tmovl\t%s, 4(%%esp)", reg_to_s(e->right->reg));
+			write("\tmovl\t%s, 0(%%esp)", reg_to_s(e->left->reg));
+		}
 		write("\tcall\tpower");
-		write("\taddl\t$8, %%esp");
 		write("\tmovl\t%%eax, %s", reg_to_s(e->reg));
+		restore_regs(e->live);
 		break;
 	case EXPR_PRE_INCR:
 		loc_from_symbol(location, e->right->symbol);
@@ -295,47 +492,565 @@ void codegen_expr(struct expr *e)
 		break;
 	case EXPR_STRING:
 		ip = hash_table_lookup(strings, e->name);
-		write("\tmovl\t$.string%d, %s", *ip, reg_to_s(e->reg));
+		if (x64) {
+			write("\tleaq\t.string%d(%%rip), %s", *ip, reg_to_q(e->reg));
+		} else {
+			write("\tmovl\t$.string%d, %s", *ip, reg_to_s(e->reg));
+		}
 		break;
 	case EXPR_NAME:
 		loc_from_symbol(location, e->symbol);
-		write("\tmovl\t%s, %s", location, reg_to_s(e->reg));
+		write("\t%s\t%s, %s", MOV(wide), location, reg_of(e->reg, wide));
 		break;
 	case EXPR_ASSIGN:
 		loc_from_symbol(location, e->symbol);
-		write("\tmovl\t%s, %s", reg_to_s(e->right->reg), location);
+		write("\t%s\t%s, %s", MOV(wide), reg_of(e->right->reg, wide), location);
 		break;
 	case EXPR_CALL:
+		codegen_args(e);
 		write("\tcall\t%s", e->name);
-		/* quick hack to get arity */
-		int arity = 0;
-		struct expr *arg = e->right;
-		while (arg) {
-			++arity;
-			arg = arg->right;
+		write("\t%s\t%s, %s", MOV(wide), reg_of(REG_EAX, wide), reg_of(e->reg, wide));
+		restore_regs(e->live);
+		break;
+	case EXPR_ARG:
+		/* every arg stays in its register until the call */
+		break;
+	}
+}
+
+/* condition codes for comparisons, or their negations */
+const char *cmp_cc(enum expr_kind kind, int sense)
+{
+	switch (kind) {
+	case EXPR_LE:
+		return sense ? "le" : "g";
+	case EXPR_LT:
+		return sense ? "l" : "ge";
+	case EXPR_EQ:
+		return sense ? "e" : "ne";
+	case EXPR_NE:
+		return sense ? "ne" : "e";
+	case EXPR_GT:
+		return sense ? "g" : "le";
+	case EXPR_GE:
+		return sense ? "ge" : "l";
+	default:
+		return NULL;
+	}
+}
+
+/* jumps to target if e evaluates to sense, falls through otherwise;
+   comparisons branch on the flags instead of producing 0 or 1 */
+void codegen_jump(struct expr *e, int sense, const char *target)
+{
+	char skip[32];
+	
+	switch (e->kind) {
+	case EXPR_LE:
+	case EXPR_LT:
+	case EXPR_EQ:
+	case EXPR_NE:
+	case EXPR_GT:
+	case EXPR_GE:
+		if (divisibility(e)) {
+			write("\tj%s\t%s", codegen_divisible(e, sense), target);
+			break;
 		}
-		if (arity > 0) {
-			write("\taddl\t$%d, %%esp", arity * 4);
+		codegen_expr(e->left);
+		codegen_expr(e->right);
+		codegen_cmp(e);
+		write("\tj%s\t%s", cmp_cc(e->kind, sense), target);
+		break;
+	case EXPR_NOT:
+		codegen_jump(e->right, !sense, target);
+		break;
+	case EXPR_AND:
+	case EXPR_OR:
+		/* && can only jump on false and || on true without
+		   evaluating the right side; the other sense skips it */
+		if (sense == (e->kind == EXPR_OR)) {
+			codegen_jump(e->left, sense, target);
+			codegen_jump(e->right, sense, target);
+		} else {
+			sprintf(skip, ".skip%d", ++skip_count);
+			codegen_jump(e->left, !sense, skip);
+			codegen_jump(e->right, sense, target);
+			write("%s:", skip);
 		}
-		write("\tmovl\t%%eax, %s", reg_to_s(e->reg));
 		break;
-	case EXPR_ARG:
-		write("\tpushl\t%s", reg_to_s(e->left->reg));
+	case EXPR_BOOLEAN:
+		if (e->constant == sense) {
+			write("\tjmp\t%s", target);
+		}
+		break;
+	default:
+		codegen_expr(e);
+		write("\ttestl\t%s, %s", reg_to_s(e->reg), reg_to_s(e->reg));
+		write("\t%s\t%s", sense ? "jne" : "je", target);
+		break;
+	}
+}
+
+const char *reg_to_q(enum reg reg)
+{
+	switch (reg) {
+	case REG_EAX:
+		return "%rax";
+	case REG_EBX:
+		return "%rbx";
+	case REG_ECX:
+		return "%rcx";
+	case REG_EDX:
+		return "%rdx";
+	case REG_ESI:
+		return "%rsi";
+	case REG_EDI:
+		return "%rdi";
+	case REG_R8:
+		return "%r8";
+	case REG_R9:
+		return "%r9";
+	case REG_R10:
+		return "%r10";
+	case REG_R11:
+		return "%r11";
+	case REG_R12:
+		return "%r12";
+	case REG_R13:
+		return "%r13";
+	case REG_R14:
+		return "%r14";
+	case REG_R15:
+		return "%r15";
+	default:
+		return NULL;
+	}
+}
+
+/* on i386 only %eax to %edx have byte forms; %eax is free between statements */
+const char *reg_to_b(enum reg reg)
+{
+	switch (reg) {
+	case REG_EBX:
+		return "%bl";
+	case REG_ECX:
+		return "%cl";
+	case REG_EDX:
+		return "%dl";
+	case REG_ESI:
+		return x64 ? "%sil" : "%al";
+	case REG_EDI:
+		return x64 ? "%dil" : "%al";
+	case REG_R8:
+		return "%r8b";
+	case REG_R9:
+		return "%r9b";
+	case REG_R10:
+		return "%r10b";
+	case REG_R11:
+		return "%r11b";
+	case REG_R12:
+		return "%r12b";
+	case REG_R13:
+		return "%r13b";
+	case REG_R14:
+		return "%r14b";
+	case REG_R15:
+		return "%r15b";
+	default:
+		return "%al";
+	}
+}
+
+const char *reg_of(enum reg reg, int wide)
+{
+	return wide ? reg_to_q(reg) : reg_to_s(reg);
+}
+
+/* the right operand only runs if the left one doesn't decide the result */
+void codegen_logical(struct expr *e)
+{
+	char skip[32];
+	sprintf(skip, ".skip%d", ++skip_count);
+	codegen_expr(e->left);
+	write("\ttestl\t%s, %s", reg_to_s(e->left->reg), reg_to_s(e->left->reg));
+	write("\t%s\t%s", e->kind == EXPR_AND ? "je" : "jne", skip);
+	codegen_expr(e->right);
+	if (e->right->reg != e->reg) {
+		write("\tmovl\t%s, %s", reg_to_s(e->right->reg), reg_to_s(e->reg));
+	}
+	write("%s:", skip);
+}
+
+/* the n % d of n % d == 0 or n % d != 0, left undivided by the selector */
+struct expr *divisibility(struct expr *e)
+{
+	if ((e->kind == EXPR_EQ || e->kind == EXPR_NE) && e->left->rule->result == NT_MODULO) {
+		return e->left;
+	}
+	return NULL;
+}
+
+/* sets the flags for a divisibility test without dividing: n is a
+   multiple of d = d0 * 2^k exactly when n * d0^-1 rotated right by k
+   is at most (2^32 - 1) / d; returns the condition code for sense */
+const char *codegen_divisible(struct expr *e, int sense)
+{
+	struct expr *mod = divisibility(e);
+	unsigned d = mod->right->constant, d0 = d;
+	int k = 0;
+	int zero = (e->kind == EXPR_EQ) == sense;
+	codegen_expr(mod->left);
+	if (log2_exact(d) >= 0) {
+		write("\ttestl\t$%u, %s", d - 1, reg_to_s(mod->left->reg));
+		return zero ? "e" : "ne";
+	}
+	while (!(d0 & 1)) {
+		d0 >>= 1;
+		++k;
+	}
+	if (mod->left->reg != e->reg) {
+		write("\tmovl\t%s, %s", reg_to_s(mod->left->reg), reg_to_s(e->reg));
+	}
+	write("\timull\t$%d, %s", (int)mod_inverse(d0), reg_to_s(e->reg));
+	if (k) {
+		write("\trorl\t$%d, %s", k, reg_to_s(e->reg));
+	}
+	write("\tcmpl\t$%u, %s", 0xffffffffU / d, reg_to_s(e->reg));
+	return zero ? "be" : "a";
+}
+
+/* like idivl after zeroing %edx, the dividend is taken as unsigned */
+void codegen_divconst(struct expr *e)
+{
+	unsigned d = e->right->constant;
+	int k = log2_exact(d);
+	struct div_magic m;
+	const char *q;
+	codegen_expr(e->left);
+	if (e->left->reg != e->reg) {
+		write("\tmovl\t%s, %s", reg_to_s(e->left->reg), reg_to_s(e->reg));
+	}
+	if (k >= 0) {
+		if (e->kind == EXPR_DIV) {
+			write("\tshrl\t$%d, %s", k, reg_to_s(e->reg));
+		} else {
+			write("\tandl\t$%u, %s", d - 1, reg_to_s(e->reg));
+		}
+		return;
+	}
+	div_magic(d, &m);
+	save_regs(e->live);
+	write("\tmovl\t$%d, %%eax", (int)m.mul);
+	write("\tmull\t%s", reg_to_s(e->reg));
+	if (m.add) {
+		write("\tmovl\t%s, %%eax", reg_to_s(e->reg));
+		write("\tsubl\t%%edx, %%eax");
+		write("\tshrl\t$1, %%eax");
+		write("\taddl\t%%edx, %%eax");
+		q = "%eax";
+	} else {
+		q = "%edx";
+	}
+	if (m.shift) {
+		write("\tshrl\t$%d, %s", m.shift, q);
+	}
+	if (e->kind == EXPR_DIV) {
+		write("\tmovl\t%s, %s", q, reg_to_s(e->reg));
+	} else {
+		write("\timull\t$%u, %s, %s", d, q, q);
+		write("\tsubl\t%s, %s", q, reg_to_s(e->reg));
+	}
+	restore_regs(e->live);
+}
+
+/* shifts and lea for 2^k, 3 * 2^k, 5 * 2^k and 9 * 2^k, negated if needed */
+void codegen_mulconst(struct expr *e)
+{
+	struct expr *c = e->right, *x = e->left;
+	unsigned a = c->constant < 0 ? -(unsigned)c->constant : c->constant;
+	enum reg src = x->reg;
+	int k = 0;
+	codegen_expr(x);
+	if (a == 0) {
+		write("\tmovl\t$0, %s", reg_to_s(e->reg));
+		return;
+	}
+	while (!(a & 1)) {
+		a >>= 1;
+		++k;
+	}
+	if (a != 1 && a != 3 && a != 5 && a != 9) {
+		write("\timull\t$%d, %s, %s", c->constant, reg_to_s(src), reg_to_s(e->reg));
+		return;
+	}
+	if (a != 1) {
+		write("\tleal\t(%s,%s,%d), %s", reg_of(src, x64), reg_of(src, x64), a - 1, reg_to_s(e->reg));
+	} else if (src != e->reg) {
+		write("\tmovl\t%s, %s", reg_to_s(src), reg_to_s(e->reg));
+	}
+	if (k) {
+		write("\tshll\t$%d, %s", k, reg_to_s(e->reg));
+	}
+	if (c->constant < 0) {
+		write("\tnegl\t%s", reg_to_s(e->reg));
+	}
+}
+
+/* square and multiply from the top bit down, with x kept in %eax */
+void codegen_powconst(struct expr *e)
+{
+	int y = e->right->constant, bit;
+	codegen_expr(e->left);
+	if (y <= 0) {
+		write("\tmovl\t$1, %s", reg_to_s(e->reg));
+		return;
+	}
+	bit = 1;
+	while (bit * 2 <= y) {
+		bit *= 2;
+	}
+	if (y != bit) {
+		write("\tmovl\t%s, %%eax", reg_to_s(e->reg));
+	}
+	for (bit /= 2; bit; bit /= 2) {
+		write("\timull\t%s, %s", reg_to_s(e->reg), reg_to_s(e->reg));
+		if (y & bit) {
+			write("\timull\t%%eax, %s", reg_to_s(e->reg));
+		}
+	}
+}
+
+void codegen_cmp(struct expr *e)
+{
+	char right[256];
+	int wide = WIDE(e->left);
+	operand(right, e->right, wide);
+	write("\tcmp%c\t%s, %s", wide ? 'q' : 'l', right, reg_of(e->left->reg, wide));
+}
+
+void codegen_setcc(struct expr *e)
+{
+	codegen_cmp(e);
+	write("\tset%s\t%s", cmp_cc(e->kind, 1), reg_to_b(e->reg));
+	write("\tmovzbl\t%s, %s", reg_to_b(e->reg), reg_to_s(e->reg));
+}
+
+/* a selected operand: a register, an immediate or a variable */
+void operand(char *buffer, struct expr *e, int wide)
+{
+	switch (e->rule->result) {
+	case NT_IMM:
+		sprintf(buffer, "$%d", e->constant);
+		break;
+	case NT_MEM:
+		loc_from_symbol(buffer, e->symbol);
 		break;
+	default:
+		strcpy(buffer, reg_of(e->reg, wide));
+		break;
+	}
+}
+
+/* writes the selected rule's instruction: %d is the result register, %l
+   and %r the operands, %m the assigned variable, %L and %R the operand
+   registers in an address, %X and %S the register and scale of an index
+   and %c the right constant */
+void emit(struct expr *e)
+{
+	char line[256], buffer[256], *p = line;
+	const char *t;
+	struct expr *index = e->left && e->left->rule->result == NT_INDEX ? e->left : e->right;
+	for (t = e->rule->tmpl; *t; ++t) {
+		if (*t != '%') {
+			*p++ = *t;
+			continue;
+		}
+		switch (*++t) {
+		case 'd':
+			strcpy(buffer, reg_to_s(e->reg));
+			break;
+		case 'l':
+			operand(buffer, e->left, 0);
+			break;
+		case 'r':
+			operand(buffer, e->right, 0);
+			break;
+		case 'm':
+			loc_from_symbol(buffer, e->symbol);
+			break;
+		case 'L':
+			strcpy(buffer, reg_of(e->left->reg, x64));
+			break;
+		case 'R':
+			strcpy(buffer, reg_of(e->right->reg, x64));
+			break;
+		case 'X':
+			strcpy(buffer, reg_of(index->reg, x64));
+			break;
+		case 'S':
+			sprintf(buffer, "%d", index->right->constant);
+			break;
+		case 'c':
+			sprintf(buffer, "%d", e->right->constant);
+			break;
+		}
+		p += sprintf(p, "%s", buffer);
+	}
+	*p = '\0';
+	if (*line) {
+		write("\t%s", line);
+	}
+}
+
+void frame_loc(char *buffer, int offset)
+{
+	if (!use_sp) {
+		sprintf(buffer, "%d(%s)", offset - frame_size, FP);
+	} else if (red_zone) {
+		sprintf(buffer, "%d(%s)", offset - frame_size, SP);
+	} else {
+		sprintf(buffer, "%d(%s)", offset, SP);
+	}
+}
+
+/* where param i lives when not in a register: stack params sit above the return address, at
+   their cdecl offsets on i386 and after the register ones on x86-64 */
+void param_loc(char *buffer, int i)
+{
+	if (x64 && i < target->num_arg_regs) {
+		frame_loc(buffer, params_base + i * word);
+	} else {
+		frame_loc(buffer, frame_size + (use_sp ? word : 2 * word) +
+		          (x64 ? i - target->num_arg_regs : i) * word);
 	}
 }
 
 void loc_from_symbol(char *buffer, struct symbol *s)
 {
+	enum reg reg;
 	switch (s->kind) {
 	case SYMBOL_GLOBAL:
-		strcpy(buffer, s->name);
+		sprintf(buffer, x64 ? "%s(%%rip)" : "%s", s->name);
 		break;
 	case SYMBOL_PARAM:
-		sprintf(buffer, "%d(%%ebp)", (s->offset + 2) * 4);
+		reg = arg_reg(target, func->symbol, s->offset);
+		if (reg & func->param_regs) {
+			strcpy(buffer, reg_of(reg, x64 && s->type->kind == TYPE_STRING));
+		} else {
+			param_loc(buffer, s->offset);
+		}
 		break;
 	case SYMBOL_LOCAL:
-		sprintf(buffer, "%d(%%ebp)", (s->offset + 1) * -4);
+		frame_loc(buffer, locals_base + s->offset * word);
 		break;
 	}
 }
+
+/* where arg i of a call into the runtime goes */
+void runtime_arg(char *buffer, int i, int wide)
+{
+	if (x64) {
+		strcpy(buffer, reg_of(target->arg_regs[i], wide));
+	} else {
+		sprintf(buffer, "%d(%%esp)", i * 4);
+	}
+}
+
+/* args beyond the register ones go to the bottom of the frame, where the
+   callee finds them just above its return address */
+void codegen_args(struct expr *e)
+{
+	struct expr *arg;
+	enum reg from[6], to[6];
+	int i = 0, n = 0, wide;
+	for (arg = e->right; arg; arg = arg->right, ++i) {
+		if (arg_reg(target, e->symbol, i)) {
+			from[n] = arg->left->reg;
+			to[n++] = arg_reg(target, e->symbol, i);
+		} else {
+			wide = WIDE(arg->left);
+			write("\t%s\t%s, %d(%s)", MOV(wide), reg_of(arg->left->reg, wide),
+			      (x64 ? i - target->num_arg_regs : i) * word, SP);
+		}
+	}
+	parallel_move(from, to, n);
+}
+
+static int move_blocked(enum reg *from, enum reg *to, int n, int i)
+{
+	int j;
+	for (j = 0; j < n; ++j) {
+		if (j != i && to[j] && from[j] == to[i]) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* moves every from[i] into to[i] at once; a cycle is broken by parking
+   one value in %eax, which nothing else holds between statements */
+void parallel_move(enum reg *from, enum reg *to, int n)
+{
+	int i, pending = n, moved;
+	while (pending > 0) {
+		moved = 0;
+		for (i = 0; i < n; ++i) {
+			if (!to[i]) {
+				continue;
+			}
+			if (from[i] != to[i]) {
+				if (move_blocked(from, to, n, i)) {
+					continue;
+				}
+				write("\tmov%c\t%s, %s", SUFFIX, reg_of(from[i], x64), reg_of(to[i], x64));
+			}
+			to[i] = 0;
+			--pending;
+			moved = 1;
+		}
+		if (!moved) {
+			i = 0;
+			while (!to[i]) {
+				++i;
+			}
+			write("\tmov%c\t%s, %s", SUFFIX, reg_of(from[i], x64), reg_of(REG_EAX, x64));
+			from[i] = REG_EAX;
+		}
+	}
+}
+
+static int save_slot(enum reg reg)
+{
+	int i, offset = out_size;
+	for (i = 0; target->regs[i] != reg; ++i) {
+		if (save_set & target->regs[i]) {
+			offset += word;
+		}
+	}
+	return offset;
+}
+
+void save_regs(enum reg regs)
+{
+	char location[32];
+	int i;
+	for (i = 0; i < target->num_regs; ++i) {
+		if (regs & target->regs[i]) {
+			frame_loc(location, save_slot(target->regs[i]));
+			write("\tmov%c\t%s, %s", SUFFIX, reg_of(target->regs[i], x64), location);
+		}
+	}
+}
+
+void restore_regs(enum reg regs)
+{
+	char location[32];
+	int i;
+	for (i = 0; i < target->num_regs; ++i) {
+		if (regs & target->regs[i]) {
+			frame_loc(location, save_slot(target->regs[i]));
+			write("\tmov%c\t%s, %s", SUFFIX, location, reg_of(target->regs[i], x64));
+		}
+	}
+}
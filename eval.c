@@ -0,0 +1,369 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "ast.h"
+#include "hash_table.h"
+
+static void pure_stmt(struct stmt *);
+static void pure_expr(struct expr *);
+static int eval_expr(struct expr *);
+static void eval_stmt(struct stmt *);
+
+/*
+a function is pure when it prints nothing, stores to no global and calls only pure functions.
+this is found optimistically, taking every function defined here as pure and striking out those
+that break the rule until none do, so functions calling one another can be pure. a call to a pure
+function with constant args is then worked out by running its body, within a budget of steps so
+that a loop that never ends cannot stall the build. the globals it may read are those nothing
+stores to, and anything whose result would depend on the machine, like dividing a negative
+number, gives up.
+*/
+#define EVAL_STEPS 100000
+#define EVAL_DEPTH 100
+
+static struct hash_table *funcs;
+static struct hash_table *globals;
+static struct hash_table *stored;
+static struct symbol *current;
+static int changed;
+
+/* the call being worked out */
+static int *vars;
+static int num_params;
+static int steps;
+static int depth;
+static int failed;
+static int returning;
+static int result;
+
+void eval_begin(struct prog *prog)
+{
+	struct decl *d;
+	funcs = hash_table_create(0, 0);
+	globals = hash_table_create(0, 0);
+	stored = hash_table_create(0, 0);
+	for (d = prog->ast; d; d = d->next) {
+		if (d->type->kind != TYPE_FUNCTION) {
+			hash_table_insert(globals, d->name, d, NULL);
+		} else if (d->code) {
+			hash_table_insert(funcs, d->name, d, NULL);
+			d->symbol->pure = 1;
+		}
+	}
+	changed = 1;
+	while (changed) {
+		changed = 0;
+		for (d = prog->ast; d; d = d->next) {
+			if (d->type->kind == TYPE_FUNCTION && d->code && d->symbol->pure) {
+				current = d->symbol;
+				pure_stmt(d->code);
+			}
+		}
+	}
+}
+
+void eval_end(void)
+{
+	hash_table_delete(funcs);
+	hash_table_delete(globals);
+	hash_table_delete(stored);
+}
+
+static void impure(void)
+{
+	if (current->pure) {
+		current->pure = 0;
+		changed = 1;
+	}
+}
+
+static void store(struct symbol *s)
+{
+	if (s->kind == SYMBOL_GLOBAL) {
+		hash_table_insert(stored, s->name, s, NULL);
+		impure();
+	}
+}
+
+void pure_stmt(struct stmt *s)
+{
+	if (!s) {
+		return;
+	}
+	
+	if (s->kind == STMT_PRINT) {
+		impure();
+	}
+	if (s->decl) {
+		pure_expr(s->decl->value);
+	}
+	pure_expr(s->expr);
+	pure_stmt(s->body);
+	pure_stmt(s->ebody);
+	pure_stmt(s->next);
+}
+
+void pure_expr(struct expr *e)
+{
+	if (!e) {
+		return;
+	}
+	
+	pure_expr(e->left);
+	pure_expr(e->right);
+	
+	switch (e->kind) {
+	case EXPR_CALL:
+		if (!e->symbol->pure) {
+			impure();
+		}
+		break;
+	case EXPR_ASSIGN:
+		store(e->symbol);
+		break;
+	case EXPR_PRE_INCR:
+	case EXPR_PRE_DECR:
+		store(e->right->symbol);
+		break;
+	case EXPR_POST_INCR:
+	case EXPR_POST_DECR:
+		store(e->left->symbol);
+		break;
+	default:
+		break;
+	}
+}
+
+static int var_index(struct symbol *s)
+{
+	switch (s->kind) {
+	case SYMBOL_PARAM:
+		return s->offset;
+	case SYMBOL_LOCAL:
+		return num_params + s->offset;
+	default:
+		return -1;
+	}
+}
+
+static int fail(void)
+{
+	failed = 1;
+	return 0;
+}
+
+static int load(struct symbol *s)
+{
+	struct decl *d;
+	int i = var_index(s);
+	if (i >= 0) {
+		return vars[i];
+	}
+	d = hash_table_lookup(globals, s->name);
+	if (!d || hash_table_lookup(stored, s->name) || !d->value) {
+		return fail();
+	}
+	switch (d->value->kind) {
+	case EXPR_INT:
+	case EXPR_CHAR:
+	case EXPR_BOOLEAN:
+		return d->value->constant;
+	default:
+		return fail();
+	}
+}
+
+/* the step x++, x--, ++x or --x on the name n */
+static int step(struct expr *n, int by, int post)
+{
+	int i = var_index(n->symbol), old;
+	if (i < 0) {
+		return fail();
+	}
+	old = vars[i];
+	vars[i] = (unsigned)old + by;
+	return post ? old : vars[i];
+}
+
+/* runs the call e in the frame it is made from */
+static int call(struct expr *e)
+{
+	struct decl *d = hash_table_lookup(funcs, e->symbol->name);
+	struct expr *arg;
+	struct param *p;
+	int *args, *saved = vars, saved_params = num_params, n = 0, value;
+	if (!d || !d->symbol->pure || depth >= EVAL_DEPTH) {
+		return fail();
+	}
+	for (p = d->type->params; p; p = p->next) {
+		++n;
+	}
+	args = calloc(n + d->num_locals + 1, sizeof(int));
+	for (n = 0, arg = e->right; arg; arg = arg->right) {
+		args[n++] = eval_expr(arg->left);
+	}
+	
+	++depth;
+	vars = args;
+	num_params = n;
+	eval_stmt(d->code);
+	if (!returning) {
+		fail();
+	}
+	returning = 0;
+	value = result;
+	vars = saved;
+	num_params = saved_params;
+	--depth;
+	free(args);
+	return value;
+}
+
+int eval_expr(struct expr *e)
+{
+	int x, y;
+	if (failed || ++steps > EVAL_STEPS) {
+		return fail();
+	}
+	
+	switch (e->kind) {
+	case EXPR_INT:
+	case EXPR_CHAR:
+	case EXPR_BOOLEAN:
+		return e->constant;
+	case EXPR_STRING:
+		return fail();
+	case EXPR_NAME:
+		return load(e->symbol);
+	case EXPR_ASSIGN:
+		x = eval_expr(e->right);
+		if (var_index(e->symbol) < 0) {
+			return fail();
+		}
+		vars[var_index(e->symbol)] = x;
+		return x;
+	case EXPR_PRE_INCR:
+		return step(e->right, 1, 0);
+	case EXPR_PRE_DECR:
+		return step(e->right, -1, 0);
+	case EXPR_POST_INCR:
+		return step(e->left, 1, 1);
+	case EXPR_POST_DECR:
+		return step(e->left, -1, 1);
+	case EXPR_CALL:
+		return call(e);
+	case EXPR_AND:
+		return eval_expr(e->left) && eval_expr(e->right);
+	case EXPR_OR:
+		return eval_expr(e->left) || eval_expr(e->right);
+	case EXPR_NOT:
+		return !eval_expr(e->right);
+	case EXPR_POS:
+		return eval_expr(e->right);
+	case EXPR_NEG:
+		return -(unsigned)eval_expr(e->right);
+	default:
+		break;
+	}
+	
+	x = eval_expr(e->left);
+	y = eval_expr(e->right);
+	switch (e->kind) {
+	case EXPR_LE:
+		return x <= y;
+	case EXPR_LT:
+		return x < y;
+	case EXPR_EQ:
+		return x == y;
+	case EXPR_NE:
+		return x != y;
+	case EXPR_GT:
+		return x > y;
+	case EXPR_GE:
+		return x >= y;
+	case EXPR_ADD:
+		return (unsigned)x + y;
+	case EXPR_SUB:
+		return (unsigned)x - y;
+	case EXPR_MUL:
+		return (unsigned)x * y;
+	case EXPR_DIV:
+	case EXPR_MOD:
+		/* the backends divide with the dividend zero-extended */
+		if (y == 0 || x < 0) {
+			return fail();
+		}
+		return e->kind == EXPR_DIV ? x / y : x % y;
+	case EXPR_POW:
+		return power(x, y);
+	default:
+		return fail();
+	}
+}
+
+void eval_stmt(struct stmt *s)
+{
+	if (!s || failed || returning) {
+		return;
+	}
+	
+	switch (s->kind) {
+	case STMT_DECL:
+		vars[var_index(s->decl->symbol)] = s->decl->value ? eval_expr(s->decl->value) : 0;
+		break;
+	case STMT_EXPR:
+		eval_expr(s->expr);
+		break;
+	case STMT_IF_ELSE:
+		eval_stmt(eval_expr(s->expr) ? s->body : s->ebody);
+		break;
+	case STMT_WHILE:
+		while (!failed && !returning && eval_expr(s->expr)) {
+			eval_stmt(s->body);
+		}
+		break;
+	case STMT_RETURN:
+		result = s->expr ? eval_expr(s->expr) : 0;
+		returning = 1;
+		break;
+	case STMT_BLOCK:
+		eval_stmt(s->body);
+		break;
+	case STMT_PRINT:
+		fail();
+		break;
+	}
+	
+	eval_stmt(s->next);
+}
+
+/* works out the call e to a pure function, if its args are constants */
+int eval_call(struct expr *e, int *value)
+{
+	struct expr *arg;
+	switch (e->symbol->type->rtype->kind) {
+	case TYPE_INT:
+	case TYPE_CHAR:
+	case TYPE_BOOLEAN:
+		break;
+	default:
+		return 0;
+	}
+	for (arg = e->right; arg; arg = arg->right) {
+		switch (arg->left->kind) {
+		case EXPR_INT:
+		case EXPR_CHAR:
+		case EXPR_BOOLEAN:
+			break;
+		default:
+			return 0;
+		}
+	}
+	vars = NULL;
+	num_params = 0;
+	steps = 0;
+	depth = 0;
+	failed = 0;
+	returning = 0;
+	*value = call(e);
+	return !failed;
+}
@@ -0,0 +1,126 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "ast.h"
+
+static void frame_decl(struct decl *);
+static void frame_stmt(struct stmt *);
+static void frame_expr(struct expr *);
+
+void ast_frame(struct prog *prog, struct config *cfg)
+{
+	frame_decl(prog->ast);
+}
+
+/*
+resolve hands every local a fresh slot, and inline/prune may have since removed some of them.
+this lays the frame out again by live range. the statements of a function are numbered in
+order, and a local lives from its decl to the last statement naming it, or to the end of a loop
+it is named in but declared outside of, as the next trip round may read it. locals are then
+given slots in the order of their decls, each taking a slot whose local has died, so locals
+whose ranges do not meet share one, wherever they sit in the function.
+*/
+struct range {
+	struct decl *decl;
+	int start;
+	int end;
+};
+
+static struct range *ranges; /* by the local's offset before this */
+static struct range **order; /* the same, in the order of their decls */
+static int num_order;
+static int *loops; /* where each loop starts and ends */
+static int num_loops;
+static int pos;
+
+static void layout(struct decl *d)
+{
+	struct range *r;
+	int *slots = calloc(d->num_locals + 1, sizeof(int));
+	int num_slots = 0, i, j;
+	for (i = 0; i < num_order; ++i) {
+		r = order[i];
+		for (j = 0; j < num_loops; j += 2) {
+			if (r->start < loops[j] && r->end >= loops[j] && r->end < loops[j + 1]) {
+				r->end = loops[j + 1];
+			}
+		}
+		/* slots holds where each slot's local dies */
+		for (j = 0; j < num_slots && slots[j] >= r->start; ++j);
+		if (j == num_slots) {
+			++num_slots;
+		}
+		slots[j] = r->end;
+		r->decl->symbol->offset = j;
+	}
+	d->num_locals = num_slots;
+	free(slots);
+}
+
+void frame_decl(struct decl *d)
+{
+	if (!d) {
+		return;
+	}
+	
+	if (d->type->kind == TYPE_FUNCTION && d->code) {
+		ranges = calloc(d->num_locals + 1, sizeof(struct range));
+		order = calloc(d->num_locals + 1, sizeof(struct range *));
+		num_order = 0;
+		num_loops = 0;
+		pos = 0;
+		frame_stmt(d->code);
+		layout(d);
+		free(ranges);
+		free(order);
+		free(loops);
+		loops = NULL;
+	}
+	
+	frame_decl(d->next);
+}
+
+void frame_stmt(struct stmt *s)
+{
+	if (!s) {
+		return;
+	}
+	
+	struct range *r;
+	int start = ++pos;
+	switch (s->kind) {
+	case STMT_DECL:
+		frame_expr(s->decl->value);
+		r = &ranges[s->decl->symbol->offset];
+		r->decl = s->decl;
+		r->start = r->end = pos;
+		order[num_order++] = r;
+		break;
+	case STMT_WHILE:
+		frame_expr(s->expr);
+		frame_stmt(s->body);
+		loops = realloc(loops, (num_loops + 2) * sizeof(int));
+		loops[num_loops++] = start;
+		loops[num_loops++] = pos;
+		break;
+	default:
+		frame_expr(s->expr);
+		frame_stmt(s->body);
+		frame_stmt(s->ebody);
+		break;
+	}
+	
+	frame_stmt(s->next);
+}
+
+void frame_expr(struct expr *e)
+{
+	if (!e) {
+		return;
+	}
+	
+	if (e->symbol && e->symbol->kind == SYMBOL_LOCAL) {
+		ranges[e->symbol->offset].end = pos;
+	}
+	frame_expr(e->left);
+	frame_expr(e->right);
+}
@@ -1,26 +1,78 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "ast.h"
+#include "hash_table.h"
 
+static void inline_calls(struct prog *);
+static void constant_globals(struct prog *);
 static void inline_decl(struct decl *);
 static void inline_stmt(struct stmt **);
 static void inline_expr(struct expr **);
+static void propagate(struct decl *);
+static void prop_stmt(struct stmt *);
+static void prop_expr(struct expr **);
+static void expand_stmt(struct stmt **);
+static void expand_expr(struct expr **);
 
 void ast_inline(struct prog *prog, struct config *cfg)
 {
 	struct symbol *s = prog->symbols;
+	inline_calls(prog);
 	while (s) {
 		expr_free(&s->value);
 		s = s->next;
 	}
+	if (prog_closed(prog, cfg)) {
+		constant_globals(prog);
+	}
 	inline_decl(prog->ast);
 }
 
+static int declared_once(struct prog *prog, struct decl *d)
+{
+	struct decl *other;
+	for (other = prog->ast; other; other = other->next) {
+		if (other != d && other->symbol == d->symbol) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/*
+with the whole program here, a global nothing stores to holds its initializer throughout, so its
+reads become that constant and reduce can fold them. prune then drops its definition once
+nothing names it.
+*/
+void constant_globals(struct prog *prog)
+{
+	struct decl *d;
+	for (d = prog->ast; d; d = d->next) {
+		if (d->type->kind == TYPE_FUNCTION || d->symbol->num_writes != 0 || !d->value) {
+			continue;
+		}
+		switch (d->value->kind) {
+		case EXPR_INT:
+		case EXPR_CHAR:
+		case EXPR_BOOLEAN:
+			if (declared_once(prog, d)) {
+				d->symbol->value = expr_copy(d->value);
+			}
+			break;
+		default:
+			break;
+		}
+	}
+}
+
 void inline_decl(struct decl *d)
 {
 	if (!d) {
 		return;
 	}
 	
+	propagate(d);
 	inline_stmt(&d->code);
 	inline_expr(&d->value);
 	if (d->symbol->kind == SYMBOL_LOCAL &&
@@ -76,3 +128,1028 @@ void inline_expr(struct expr **ep)
 		break;
 	}
 }
+
+/*
+constants and copies are carried forward through each function: after x = 5 or int x = y, reads
+of x that only that store can reach become 5 or y, until x or y is stored to again. where paths
+join, in an if/else or at a loop's head, only what every path agrees on is kept; a loop is gone
+round until its head settles before anything in it is rewritten. only params and locals are
+followed, as calls can change globals. an expression storing to a variable has none of its
+reads of that variable rewritten, as which one comes first is up to the backend.
+*/
+static int num_params;
+static int num_vars;
+static int rewriting;
+/* per variable: a constant, a name it holds a copy of, or NULL */
+static struct expr **facts;
+/* per variable: stores to it in the expression being rewritten */
+static int *stores;
+
+static int var_index(struct symbol *s)
+{
+	switch (s->kind) {
+	case SYMBOL_PARAM:
+		return s->offset;
+	case SYMBOL_LOCAL:
+		return num_params + s->offset;
+	default:
+		return -1;
+	}
+}
+
+static struct expr **facts_copy(struct expr **from)
+{
+	struct expr **to = malloc((num_vars + 1) * sizeof(struct expr *));
+	int i;
+	for (i = 0; i < num_vars; ++i) {
+		to[i] = expr_copy(from[i]);
+	}
+	return to;
+}
+
+static void facts_free(struct expr ***fp)
+{
+	int i;
+	for (i = 0; i < num_vars; ++i) {
+		expr_free(&(*fp)[i]);
+	}
+	free(*fp);
+	*fp = NULL;
+}
+
+static int fact_eq(struct expr *a, struct expr *b)
+{
+	if (!a || !b) {
+		return a == b;
+	}
+	return a->kind == b->kind && a->constant == b->constant && a->symbol == b->symbol &&
+	       (a->kind != EXPR_STRING || !strcmp(a->name, b->name));
+}
+
+/* keeps in facts only what other agrees with */
+static int facts_meet(struct expr **other)
+{
+	int i, changed = 0;
+	for (i = 0; i < num_vars; ++i) {
+		if (facts[i] && !fact_eq(facts[i], other[i])) {
+			expr_free(&facts[i]);
+			changed = 1;
+		}
+	}
+	return changed;
+}
+
+static void count_stores(struct expr *e)
+{
+	int i = -1;
+	if (!e) {
+		return;
+	}
+	count_stores(e->left);
+	count_stores(e->right);
+	switch (e->kind) {
+	case EXPR_ASSIGN:
+		i = var_index(e->symbol);
+		break;
+	case EXPR_PRE_INCR:
+	case EXPR_PRE_DECR:
+		i = var_index(e->right->symbol);
+		break;
+	case EXPR_POST_INCR:
+	case EXPR_POST_DECR:
+		i = var_index(e->left->symbol);
+		break;
+	default:
+		break;
+	}
+	if (i >= 0) {
+		++stores[i];
+	}
+}
+
+/* what e is known to hold once evaluated, as a fact */
+static struct expr *value_of(struct expr *e)
+{
+	int i;
+	if (!e) {
+		return NULL;
+	}
+	switch (e->kind) {
+	case EXPR_INT:
+	case EXPR_CHAR:
+	case EXPR_BOOLEAN:
+	case EXPR_STRING:
+		return expr_copy(e);
+	case EXPR_NAME:
+		if ((i = var_index(e->symbol)) < 0 || stores[i]) {
+			return NULL;
+		}
+		return expr_copy(facts[i] ? facts[i] : e);
+	default:
+		return NULL;
+	}
+}
+
+/* drops the facts that are copies of the variable at i */
+static void unname(int i)
+{
+	int n;
+	for (n = 0; n < num_vars; ++n) {
+		if (facts[n] && facts[n]->kind == EXPR_NAME && var_index(facts[n]->symbol) == i) {
+			expr_free(&facts[n]);
+		}
+	}
+}
+
+/* records a store of value, which it takes, to the variable at i */
+static void store(int i, struct expr *value, int known)
+{
+	unname(i);
+	expr_free(&facts[i]);
+	if (known && value && !(value->kind == EXPR_NAME && var_index(value->symbol) == i)) {
+		facts[i] = value;
+	} else {
+		expr_free(&value);
+	}
+}
+
+/* applies the stores in e; those under && or || may not happen */
+static void apply(struct expr *e, int maybe)
+{
+	if (!e) {
+		return;
+	}
+	apply(e->left, maybe);
+	apply(e->right, maybe || e->kind == EXPR_AND || e->kind == EXPR_OR);
+	switch (e->kind) {
+	case EXPR_ASSIGN:
+		if (var_index(e->symbol) >= 0) {
+			store(var_index(e->symbol), value_of(e->right), !maybe && stores[var_index(e->symbol)] == 1);
+		}
+		break;
+	case EXPR_PRE_INCR:
+	case EXPR_PRE_DECR:
+		if (var_index(e->right->symbol) >= 0) {
+			store(var_index(e->right->symbol), NULL, 0);
+		}
+		break;
+	case EXPR_POST_INCR:
+	case EXPR_POST_DECR:
+		if (var_index(e->left->symbol) >= 0) {
+			store(var_index(e->left->symbol), NULL, 0);
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+/* rewrites the reads in e of what is known */
+void prop_expr(struct expr **ep)
+{
+	struct expr *e = *ep;
+	int i;
+	if (!e) {
+		return;
+	}
+	
+	switch (e->kind) {
+	case EXPR_PRE_INCR:
+	case EXPR_PRE_DECR:
+	case EXPR_POST_INCR:
+	case EXPR_POST_DECR:
+		/* the name is stored to, not read */
+		return;
+	case EXPR_NAME:
+		if ((i = var_index(e->symbol)) >= 0 && !stores[i] && facts[i]) {
+			*ep = expr_copy(facts[i]);
+			expr_free(&e);
+		}
+		return;
+	default:
+		prop_expr(&e->left);
+		prop_expr(&e->right);
+	}
+}
+
+/* a whole expression: its reads are rewritten, then its stores noted */
+static void prop_root(struct expr **ep)
+{
+	struct expr *e = *ep;
+	int i = -1;
+	memset(stores, 0, num_vars * sizeof(int));
+	count_stores(e);
+	if (e && e->kind == EXPR_ASSIGN && (i = var_index(e->symbol)) >= 0 && stores[i] != 1) {
+		i = -1;
+	}
+	if (rewriting && i >= 0) {
+		/* x = ... x ... reads x before the one store */
+		stores[i] = 0;
+		prop_expr(&e->right);
+		stores[i] = 1;
+	} else if (rewriting) {
+		prop_expr(ep);
+	}
+	apply(*ep, 0);
+}
+
+static void prop_while(struct stmt *s)
+{
+	struct expr **head = facts_copy(facts), **end;
+	int rewrite = rewriting, changed = 1;
+	
+	/* the head is reached from before the loop and from the body's end */
+	rewriting = 0;
+	while (changed) {
+		facts_free(&facts);
+		facts = facts_copy(head);
+		prop_root(&s->expr);
+		prop_stmt(s->body);
+		end = facts;
+		facts = head;
+		changed = facts_meet(end);
+		head = facts;
+		facts = end;
+	}
+	rewriting = rewrite;
+	
+	facts_free(&facts);
+	facts = head;
+	prop_root(&s->expr);
+	end = facts_copy(facts);
+	prop_stmt(s->body);
+	facts_free(&facts);
+	facts = end;
+}
+
+void prop_stmt(struct stmt *s)
+{
+	struct expr **other, **then;
+	struct stmt *body;
+	struct decl *d;
+	if (!s) {
+		return;
+	}
+	
+	switch (s->kind) {
+	case STMT_DECL:
+		d = s->decl;
+		if (var_index(d->symbol) >= 0) {
+			prop_root(&d->value);
+			store(var_index(d->symbol), value_of(d->value), d->value && !stores[var_index(d->symbol)]);
+		}
+		break;
+	case STMT_EXPR:
+	case STMT_PRINT:
+	case STMT_RETURN:
+		prop_root(&s->expr);
+		break;
+	case STMT_IF_ELSE:
+		prop_root(&s->expr);
+		other = facts_copy(facts);
+		prop_stmt(s->body);
+		then = facts;
+		facts = other;
+		prop_stmt(s->ebody);
+		facts_meet(then);
+		facts_free(&then);
+		break;
+	case STMT_WHILE:
+		prop_while(s);
+		break;
+	case STMT_BLOCK:
+		prop_stmt(s->body);
+		/* the block's locals go out of scope, and frame may hand their slots on */
+		for (body = s->body; body; body = body->next) {
+			if (body->kind == STMT_DECL && var_index(body->decl->symbol) >= 0) {
+				unname(var_index(body->decl->symbol));
+			}
+		}
+		break;
+	}
+	
+	prop_stmt(s->next);
+}
+
+void propagate(struct decl *d)
+{
+	struct param *p;
+	if (d->type->kind != TYPE_FUNCTION || !d->code) {
+		return;
+	}
+	num_params = 0;
+	for (p = d->type->params; p; p = p->next) {
+		++num_params;
+	}
+	num_vars = num_params + d->num_locals;
+	facts = calloc(num_vars + 1, sizeof(struct expr *));
+	stores = calloc(num_vars + 1, sizeof(int));
+	rewriting = 1;
+	prop_stmt(d->code);
+	facts_free(&facts);
+	free(stores);
+}
+
+/*
+calls are expanded in place, callees before their callers over the call graph so that what has
+been inlined into a function goes along when it is inlined in turn. a function on a cycle of
+calls is never inlined. a function that is just return e has a call to it replaced by e with the
+args put in for its params, where that keeps what the args read and do. otherwise a call making
+up a whole statement, as in f(...); x = f(...); int x = f(...); or return f(...); becomes a block
+declaring the params as new locals of the caller set to the args, then a copy of the body with
+its locals renamed into the caller's frame and its returns made into stores of the result. that
+needs every return to be the last thing the body does, bar one ending the then arm of an if
+with no else, whose rest of the body becomes the else arm.
+
+the copies are counted and chained as they are made, so what runs after this in the pass sees
+them without ast_annotate going over the program again. a copied read links to the copies of the
+callee's stores reaching it, a param's value on entry being its new decl, and the result stores
+take over the reads of the store at the call site. counts of what the call site held are left as
+they were, which errs towards keeping things.
+
+a callee is inlined if its size in nodes is under what the call would cost, with more allowed
+for constant args that may fold away, for leaf functions and for functions called only once.
+*/
+#define INLINE_SIZE 12 /* a call, its prologue and its epilogue */
+#define INLINE_ARG 2
+#define INLINE_CONST 6
+#define INLINE_LEAF 6
+#define INLINE_ONCE 60
+#define INLINE_GROWTH 400 /* no caller grows past this by inlining */
+
+struct func {
+	struct decl *decl;
+	struct func **callees;
+	int num_callees;
+	int visited;
+	int cyclic;
+	int size;
+};
+
+enum site {
+	SITE_VALUE,   /* f(...) anywhere, as an expression */
+	SITE_DISCARD, /* f(...); */
+	SITE_STORE,   /* x = f(...); or int x = f(...); */
+	SITE_RETURN   /* return f(...); */
+};
+
+static struct prog *prog;
+static struct hash_table *funcs;
+static struct decl *caller;
+static int caller_size;
+/* the callee being copied: its params, its symbols' new decls and its args */
+static int callee_params;
+static struct decl **renamed;
+static struct expr **substituted;
+static enum site site;
+static struct symbol *result;
+static struct chain *site_reads; /* those the store at the call site reaches */
+/* the callee's nodes copied so far and their copies */
+static struct expr **originals;
+static struct expr **copies;
+static int num_copies;
+
+static int expr_size(struct expr *e)
+{
+	return e ? 1 + expr_size(e->left) + expr_size(e->right) : 0;
+}
+
+static int stmt_size(struct stmt *s)
+{
+	if (!s) {
+		return 0;
+	}
+	return 1 + (s->decl ? expr_size(s->decl->value) : 0) + expr_size(s->expr) +
+	       stmt_size(s->body) + stmt_size(s->ebody) + stmt_size(s->next);
+}
+
+static struct func *callee(struct expr *e)
+{
+	if (!e || e->kind != EXPR_CALL) {
+		return NULL;
+	}
+	return hash_table_lookup(funcs, e->symbol->name);
+}
+
+static void add_callees(struct func *f, struct expr *e)
+{
+	struct func *g;
+	if (!e) {
+		return;
+	}
+	add_callees(f, e->left);
+	add_callees(f, e->right);
+	if ((g = callee(e))) {
+		f->callees = realloc(f->callees, (f->num_callees + 1) * sizeof(struct func *));
+		f->callees[f->num_callees++] = g;
+	}
+}
+
+static void find_callees(struct func *f, struct stmt *s)
+{
+	if (!s) {
+		return;
+	}
+	if (s->decl) {
+		add_callees(f, s->decl->value);
+	}
+	add_callees(f, s->expr);
+	find_callees(f, s->body);
+	find_callees(f, s->ebody);
+	find_callees(f, s->next);
+}
+
+static int reaches(struct func *f, struct func *target, int stamp)
+{
+	int i;
+	if (f == target) {
+		return 1;
+	}
+	if (f->visited == stamp) {
+		return 0;
+	}
+	f->visited = stamp;
+	for (i = 0; i < f->num_callees; ++i) {
+		if (reaches(f->callees[i], target, stamp)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* whether f calls itself, directly or not */
+static int on_cycle(struct func *f, int stamp)
+{
+	int i;
+	for (i = 0; i < f->num_callees; ++i) {
+		if (reaches(f->callees[i], f, stamp)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static char *name_copy(const char *name)
+{
+	char *copy;
+	if (!name) {
+		return NULL;
+	}
+	copy = malloc(strlen(name) + 1);
+	strcpy(copy, name);
+	return copy;
+}
+
+/* where a symbol of the callee sits in renamed and substituted */
+static int callee_index(struct symbol *s)
+{
+	if (!s) {
+		return -1;
+	}
+	switch (s->kind) {
+	case SYMBOL_PARAM:
+		return s->offset;
+	case SYMBOL_LOCAL:
+		return callee_params + s->offset;
+	default:
+		return -1;
+	}
+}
+
+/* counts the read or write the copy e makes, as ast_annotate would */
+static void count(struct expr *e)
+{
+	switch (e->kind) {
+	case EXPR_NAME:
+	case EXPR_CALL:
+		++e->symbol->num_reads;
+		break;
+	case EXPR_ASSIGN:
+		++e->symbol->num_writes;
+		break;
+	case EXPR_PRE_INCR:
+	case EXPR_PRE_DECR:
+		++e->right->symbol->num_writes;
+		break;
+	case EXPR_POST_INCR:
+	case EXPR_POST_DECR:
+		++e->left->symbol->num_writes;
+		break;
+	default:
+		break;
+	}
+}
+
+/* copies the callee's e, with its params substituted or its symbols renamed */
+static struct expr *copy_expr(struct expr *e)
+{
+	struct expr *copy, **args = substituted;
+	int i;
+	if (!e) {
+		return NULL;
+	}
+	i = callee_index(e->symbol);
+	if (args && e->kind == EXPR_NAME && i >= 0) {
+		/* the arg is the caller's own, chains and all. one read twice is still counted */
+		return expr_copy(args[i]);
+	}
+	copy = expr_make(e->kind, copy_expr(e->left), copy_expr(e->right), name_copy(e->name), e->constant);
+	copy->symbol = renamed && i >= 0 ? renamed[i]->symbol : e->symbol;
+	count(copy);
+	originals = realloc(originals, (num_copies + 1) * sizeof(struct expr *));
+	copies = realloc(copies, (num_copies + 1) * sizeof(struct expr *));
+	originals[num_copies] = e;
+	copies[num_copies++] = copy;
+	return copy;
+}
+
+static struct expr *copy_of(struct expr *e)
+{
+	int i;
+	for (i = 0; i < num_copies; ++i) {
+		if (originals[i] == e) {
+			return copies[i];
+		}
+	}
+	return NULL;
+}
+
+/* links each copied read as its original is linked, within the copy */
+static void link_copies(void)
+{
+	struct chain *c;
+	struct expr *def;
+	struct decl *d;
+	int i;
+	for (i = 0; i < num_copies; ++i) {
+		if (originals[i]->kind != EXPR_NAME) {
+			continue;
+		}
+		for (c = originals[i]->chain; c; c = c->next) {
+			def = c->expr ? copy_of(c->expr) : NULL;
+			d = NULL;
+			if (c->decl) {
+				d = renamed[callee_index(c->decl->symbol)];
+			} else if (!c->expr) {
+				d = renamed[callee_index(originals[i]->symbol)];
+			}
+			/* a store after a return was never copied */
+			if (def || d) {
+				chain_link(copies[i], def, d);
+			}
+		}
+	}
+	num_copies = 0;
+}
+
+/* a new local of the caller, standing for the callee's symbol at i */
+static struct decl *new_local(int i, const char *name, struct type *type, struct expr *value)
+{
+	struct decl *d = decl_make(name_copy(name), type_make(type->kind, NULL, NULL), value, NULL);
+	d->symbol = symbol_make(SYMBOL_LOCAL, d->type, d->name, prog);
+	d->symbol->offset = caller->num_locals++;
+	renamed[i] = d;
+	return d;
+}
+
+static struct stmt *returned(struct expr *e)
+{
+	struct expr *store;
+	struct chain *c;
+	switch (site) {
+	case SITE_RETURN:
+		return stmt_make(STMT_RETURN, NULL, e, NULL, NULL);
+	case SITE_STORE:
+		store = expr_make(EXPR_ASSIGN, NULL, e, name_copy(result->name), 0);
+		store->symbol = result;
+		++result->num_writes;
+		for (c = site_reads; c; c = c->next) {
+			chain_link(c->expr, store, NULL);
+		}
+		return stmt_make(STMT_EXPR, NULL, store, NULL, NULL);
+	default:
+		return e ? stmt_make(STMT_EXPR, NULL, e, NULL, NULL) : NULL;
+	}
+}
+
+static int empty(struct stmt *s)
+{
+	return !s || (s->kind == STMT_BLOCK && !s->body);
+}
+
+/* whether every path through the list s ends in a return */
+static int ends_in_return(struct stmt *s)
+{
+	if (!s) {
+		return 0;
+	}
+	while (s->next) {
+		s = s->next;
+	}
+	switch (s->kind) {
+	case STMT_RETURN:
+		return 1;
+	case STMT_IF_ELSE:
+		return ends_in_return(s->body) && ends_in_return(s->ebody);
+	case STMT_BLOCK:
+		return ends_in_return(s->body);
+	default:
+		return 0;
+	}
+}
+
+/* an if whose then arm returns and which has no else, but a rest of the list */
+static int early_return(struct stmt *s)
+{
+	return s->kind == STMT_IF_ELSE && s->next && empty(s->ebody) && ends_in_return(s->body);
+}
+
+/* whether the returns in the list s are each the last thing done, tail saying s is */
+static int tail_returns(struct stmt *s, int tail)
+{
+	int last;
+	for (; s; s = s->next) {
+		last = tail && !s->next;
+		switch (s->kind) {
+		case STMT_RETURN:
+			return last;
+		case STMT_IF_ELSE:
+			if (early_return(s)) {
+				return tail_returns(s->body, tail) && tail_returns(s->next, tail);
+			}
+			if (!tail_returns(s->body, last) || !tail_returns(s->ebody, last)) {
+				return 0;
+			}
+			break;
+		case STMT_WHILE:
+			if (!tail_returns(s->body, 0)) {
+				return 0;
+			}
+			break;
+		case STMT_BLOCK:
+			if (!tail_returns(s->body, last)) {
+				return 0;
+			}
+			break;
+		default:
+			break;
+		}
+	}
+	return 1;
+}
+
+/* copies the callee's list s into the caller */
+static struct stmt *copy_stmt(struct stmt *s)
+{
+	struct stmt *copy;
+	struct decl *d = NULL;
+	if (!s) {
+		return NULL;
+	}
+	
+	switch (s->kind) {
+	case STMT_RETURN:
+		/* anything after it never runs */
+		return returned(copy_expr(s->expr));
+	case STMT_DECL:
+		d = new_local(callee_params + s->decl->symbol->offset, s->decl->name,
+		              s->decl->type, NULL);
+		d->value = copy_expr(s->decl->value);
+		break;
+	case STMT_IF_ELSE:
+		if (early_return(s)) {
+			/* the rest of the list becomes the else arm */
+			return stmt_make(STMT_IF_ELSE, NULL, copy_expr(s->expr), copy_stmt(s->body),
+			                 stmt_make(STMT_BLOCK, NULL, NULL, copy_stmt(s->next), NULL));
+		}
+		break;
+	default:
+		break;
+	}
+	copy = stmt_make(s->kind, d, copy_expr(s->expr), copy_stmt(s->body), copy_stmt(s->ebody));
+	copy->next = copy_stmt(s->next);
+	return copy;
+}
+
+/* what f returns, if its body is just a return */
+static struct expr *body_value(struct func *f)
+{
+	struct stmt *s = f->decl->code;
+	while (s && s->kind == STMT_BLOCK && !s->next) {
+		s = s->body;
+	}
+	return s && s->kind == STMT_RETURN && !s->next ? s->expr : NULL;
+}
+
+static int num_params_of(struct decl *d)
+{
+	struct param *p;
+	int n = 0;
+	for (p = d->type->params; p; p = p->next) {
+		++n;
+	}
+	return n;
+}
+
+static int worth(struct func *f, struct expr *call)
+{
+	struct expr *arg;
+	int limit = INLINE_SIZE;
+	if (f->cyclic || f->decl == caller || caller_size + f->size > INLINE_GROWTH) {
+		return 0;
+	}
+	for (arg = call->right; arg; arg = arg->right) {
+		limit += INLINE_ARG;
+		if (expr_is_const(arg->left)) {
+			limit += INLINE_CONST;
+		}
+	}
+	if (!f->num_callees) {
+		limit += INLINE_LEAF;
+	}
+	if (f->decl->symbol->num_reads == 1 && limit < INLINE_ONCE) {
+		limit = INLINE_ONCE;
+	}
+	return f->size <= limit;
+}
+
+static int reads_globals(struct expr *e)
+{
+	if (!e) {
+		return 0;
+	}
+	/* a call may, even a pure one */
+	if (e->kind == EXPR_CALL || (e->kind == EXPR_NAME && e->symbol->kind == SYMBOL_GLOBAL)) {
+		return 1;
+	}
+	return reads_globals(e->left) || reads_globals(e->right);
+}
+
+/* no calls or stores */
+static int quiet(struct expr *e)
+{
+	if (!e) {
+		return 1;
+	}
+	switch (e->kind) {
+	case EXPR_CALL:
+	case EXPR_ASSIGN:
+	case EXPR_PRE_INCR:
+	case EXPR_PRE_DECR:
+	case EXPR_POST_INCR:
+	case EXPR_POST_DECR:
+		return 0;
+	default:
+		return quiet(e->left) && quiet(e->right);
+	}
+}
+
+/* counts the reads of each param in e, failing on a store to one */
+static int param_uses(struct expr *e, int *uses)
+{
+	struct expr *name = NULL;
+	if (!e) {
+		return 1;
+	}
+	switch (e->kind) {
+	case EXPR_NAME:
+		if (e->symbol->kind == SYMBOL_PARAM) {
+			++uses[e->symbol->offset];
+		}
+		break;
+	case EXPR_ASSIGN:
+		if (e->symbol->kind == SYMBOL_PARAM) {
+			return 0;
+		}
+		break;
+	case EXPR_PRE_INCR:
+	case EXPR_PRE_DECR:
+		name = e->right;
+		break;
+	case EXPR_POST_INCR:
+	case EXPR_POST_DECR:
+		name = e->left;
+		break;
+	default:
+		break;
+	}
+	if (name && name->symbol->kind == SYMBOL_PARAM) {
+		return 0;
+	}
+	return param_uses(e->left, uses) && param_uses(e->right, uses);
+}
+
+/* whether arg can stand in for each of uses reads of its param in value */
+static int substitutable(struct expr *arg, int uses, struct expr *value)
+{
+	if (expr_is_const(arg) && !expr_has_effects(arg)) {
+		return 1;
+	}
+	if (arg->kind == EXPR_NAME) {
+		/* value cannot store to the caller's own variables */
+		return arg->symbol->kind != SYMBOL_GLOBAL || quiet(value);
+	}
+	if (expr_has_effects(arg) || uses > 1) {
+		return 0;
+	}
+	return !reads_globals(arg) || quiet(value);
+}
+
+/* replaces a call to a function that is just return e by e */
+static int expand_value(struct expr **ep)
+{
+	struct expr *call = *ep, *value, *arg, **args;
+	struct func *f = callee(call);
+	int *uses, i, ok;
+	if (!f || !(value = body_value(f)) || !worth(f, call)) {
+		return 0;
+	}
+	callee_params = num_params_of(f->decl);
+	uses = calloc(callee_params + 1, sizeof(int));
+	args = calloc(callee_params + 1, sizeof(struct expr *));
+	ok = param_uses(value, uses);
+	for (i = 0, arg = call->right; ok && arg; ++i, arg = arg->right) {
+		args[i] = arg->left;
+		ok = substitutable(arg->left, uses[i], value);
+	}
+	if (ok) {
+		substituted = args;
+		renamed = NULL;
+		*ep = copy_expr(value);
+		substituted = NULL;
+		num_copies = 0;
+		expr_free(&call);
+		caller_size += f->size;
+	}
+	free(uses);
+	free(args);
+	return ok;
+}
+
+/* the call making up the whole of s, if any, noting where its result goes */
+static struct expr **site_of(struct stmt *s)
+{
+	struct expr **ep = NULL;
+	result = NULL;
+	site_reads = NULL;
+	switch (s->kind) {
+	case STMT_DECL:
+		site = SITE_STORE;
+		result = s->decl->symbol;
+		site_reads = s->decl->uses;
+		ep = &s->decl->value;
+		break;
+	case STMT_EXPR:
+		site = SITE_DISCARD;
+		ep = &s->expr;
+		if (s->expr->kind == EXPR_ASSIGN) {
+			site = SITE_STORE;
+			result = s->expr->symbol;
+			site_reads = s->expr->chain;
+			ep = &s->expr->right;
+		}
+		break;
+	case STMT_RETURN:
+		site = SITE_RETURN;
+		ep = &s->expr;
+		break;
+	default:
+		return NULL;
+	}
+	return *ep && (*ep)->kind == EXPR_CALL ? ep : NULL;
+}
+
+/* expands the call at the statement *sp into a block, returning what follows it */
+static struct stmt **expand_site(struct stmt **sp, struct expr **ep)
+{
+	struct stmt *s = *sp, *block, *decls = NULL, **tail = &decls;
+	struct expr *call = *ep, *arg;
+	struct param *p;
+	struct func *f = callee(call);
+	int i;
+	if (!f || !f->decl->code || !worth(f, call) ||
+	    (site != SITE_RETURN && !tail_returns(f->decl->code, 1))) {
+		return NULL;
+	}
+	
+	callee_params = num_params_of(f->decl);
+	renamed = calloc(callee_params + f->decl->num_locals + 1, sizeof(struct decl *));
+	substituted = NULL;
+	for (i = 0, p = f->decl->type->params, arg = call->right; p && arg; ++i, p = p->next, arg = arg->right) {
+		*tail = stmt_make(STMT_DECL, new_local(i, p->name, p->type, arg->left), NULL, NULL, NULL);
+		tail = &(*tail)->next;
+		arg->left = NULL;
+	}
+	*tail = copy_stmt(f->decl->code);
+	link_copies();
+	block = stmt_make(STMT_BLOCK, NULL, NULL, decls, NULL);
+	free(renamed);
+	renamed = NULL;
+	
+	if (s->kind == STMT_DECL) {
+		expr_free(ep);
+		block->next = s->next;
+		s->next = block;
+	} else {
+		block->next = s->next;
+		s->next = NULL;
+		stmt_free(&s);
+		*sp = block;
+	}
+	caller_size += f->size;
+	return &block->next;
+}
+
+void expand_expr(struct expr **ep)
+{
+	if (!ep || !(*ep)) {
+		return;
+	}
+	
+	struct expr *e = *ep;
+	
+	expand_expr(&e->left);
+	expand_expr(&e->right);
+	
+	if (e->kind == EXPR_CALL) {
+		expand_value(ep);
+	}
+}
+
+void expand_stmt(struct stmt **sp)
+{
+	if (!sp || !(*sp)) {
+		return;
+	}
+	
+	struct stmt *s = *sp, **next;
+	struct expr **ep;
+	
+	if (s->decl) {
+		expand_expr(&s->decl->value);
+	}
+	expand_expr(&s->expr);
+	if ((ep = site_of(s)) && (next = expand_site(sp, ep))) {
+		expand_stmt(next);
+		return;
+	}
+	expand_stmt(&s->body);
+	expand_stmt(&s->ebody);
+	expand_stmt(&s->next);
+}
+
+/* inlines into f after its callees */
+static void expand_func(struct func *f)
+{
+	int i;
+	if (f->visited) {
+		return;
+	}
+	f->visited = 1;
+	for (i = 0; i < f->num_callees; ++i) {
+		expand_func(f->callees[i]);
+	}
+	caller = f->decl;
+	caller_size = stmt_size(f->decl->code);
+	expand_stmt(&f->decl->code);
+	f->size = stmt_size(f->decl->code);
+}
+
+void inline_calls(struct prog *p)
+{
+	struct func **all = NULL;
+	struct decl *d;
+	int n = 0, i;
+	prog = p;
+	funcs = hash_table_create(0, 0);
+	for (d = prog->ast; d; d = d->next) {
+		if (d->type->kind == TYPE_FUNCTION && d->code) {
+			all = realloc(all, (n + 1) * sizeof(struct func *));
+			all[n] = calloc(1, sizeof(struct func));
+			all[n]->decl = d;
+			hash_table_insert(funcs, d->name, all[n], NULL);
+			++n;
+		}
+	}
+	for (i = 0; i < n; ++i) {
+		find_callees(all[i], all[i]->decl->code);
+	}
+	for (i = 0; i < n; ++i) {
+		all[i]->cyclic = on_cycle(all[i], i + 1);
+	}
+	for (i = 0; i < n; ++i) {
+		all[i]->visited = 0;
+	}
+	for (i = 0; i < n; ++i) {
+		expand_func(all[i]);
+	}
+	for (i = 0; i < n; ++i) {
+		free(all[i]->callees);
+		free(all[i]);
+	}
+	free(all);
+	free(originals);
+	free(copies);
+	originals = copies = NULL;
+	hash_table_delete(funcs);
+}
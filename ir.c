@@ -0,0 +1,957 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <limits.h>
+#include "ir.h"
+#include "hash_table.h"
+
+#define NEW(t) (malloc(sizeof(struct t)))
+
+static void lower_decl(struct decl *);
+static void lower_stmt(struct stmt *);
+static struct operand lower_expr(struct expr *);
+static void lower_cond(struct expr *, struct block *t, struct block *f);
+
+static struct hash_table *strings;
+static struct ir_func **funcs_tail;
+
+const char *ir_op_to_s(enum ir_op op)
+{
+	switch (op) {
+	case IR_COPY:
+		return "=";
+	case IR_NEG:
+		return "-";
+	case IR_NOT:
+		return "!";
+	case IR_ADD:
+		return "+";
+	case IR_SUB:
+		return "-";
+	case IR_MUL:
+		return "*";
+	case IR_DIV:
+		return "/";
+	case IR_MOD:
+		return "%";
+	case IR_POW:
+		return "^";
+	case IR_LE:
+		return "<=";
+	case IR_LT:
+		return "<";
+	case IR_EQ:
+		return "==";
+	case IR_NE:
+		return "!=";
+	case IR_GT:
+		return ">";
+	case IR_GE:
+		return ">=";
+	case IR_CALL:
+		return "call";
+	case IR_PRINT:
+		return "print";
+	case IR_RETURN:
+		return "return";
+	case IR_JUMP:
+		return "jump";
+	case IR_BRANCH:
+		return "if";
+	case IR_PHI:
+		return "phi";
+	default:
+		return NULL;
+	}
+}
+
+/* a op b as the generated code computes it, or 0 where that would trap:
+   dividends are zero-extended, so only positive divisors with quotients
+   that fit are folded */
+int ir_fold(enum ir_op op, int a, int b, int *result)
+{
+	unsigned x = a, y = b;
+	switch (op) {
+	case IR_NEG:
+		*result = -x;
+		break;
+	case IR_NOT:
+		*result = a ^ 1;
+		break;
+	case IR_ADD:
+		*result = x + y;
+		break;
+	case IR_SUB:
+		*result = x - y;
+		break;
+	case IR_MUL:
+		*result = x * y;
+		break;
+	case IR_DIV:
+	case IR_MOD:
+		if (b <= 0 || x / y > INT_MAX) {
+			return 0;
+		}
+		*result = op == IR_DIV ? x / y : x % y;
+		break;
+	case IR_POW:
+		*result = power(a, b);
+		break;
+	case IR_LE:
+		*result = a <= b;
+		break;
+	case IR_LT:
+		*result = a < b;
+		break;
+	case IR_EQ:
+		*result = a == b;
+		break;
+	case IR_NE:
+		*result = a != b;
+		break;
+	case IR_GT:
+		*result = a > b;
+		break;
+	case IR_GE:
+		*result = a >= b;
+		break;
+	default:
+		return 0;
+	}
+	return 1;
+}
+
+/* whether i calls out, to a function, the runtime's print or power() */
+int ir_calls(struct ir_insn *i)
+{
+	return i->op == IR_CALL || i->op == IR_PRINT ||
+	       (i->op == IR_POW && (i->src[1].kind != OPERAND_CONST || i->src[1].value > POW_INLINE_MAX));
+}
+
+struct operand operand_none(void)
+{
+	struct operand o;
+	o.kind = OPERAND_NONE;
+	o.type = TYPE_UNKNOWN;
+	o.value = 0;
+	o.symbol = NULL;
+	o.name = NULL;
+	return o;
+}
+
+struct operand operand_temp(struct ir_func *f, enum type_kind type)
+{
+	struct operand o = operand_none();
+	o.kind = OPERAND_TEMP;
+	o.type = type;
+	o.value = f->num_temps++;
+	return o;
+}
+
+struct operand operand_const(int value, enum type_kind type)
+{
+	struct operand o = operand_none();
+	o.kind = OPERAND_CONST;
+	o.type = type;
+	o.value = value;
+	return o;
+}
+
+static struct operand operand_var(struct symbol *s)
+{
+	struct operand o = operand_none();
+	o.kind = OPERAND_VAR;
+	o.type = s->type->kind;
+	o.symbol = s;
+	return o;
+}
+
+int operand_eq(struct operand a, struct operand b)
+{
+	if (a.kind != b.kind) {
+		return 0;
+	}
+	
+	switch (a.kind) {
+	case OPERAND_NONE:
+		return 1;
+	case OPERAND_VAR:
+		return a.symbol == b.symbol;
+	default:
+		return a.value == b.value;
+	}
+}
+
+struct ir_insn *ir_insn_make(enum ir_op op, struct operand dst, struct operand a, struct operand b)
+{
+	struct ir_insn *i = NEW(ir_insn);
+	i->op = op;
+	i->cmp = IR_NE;
+	i->dst = dst;
+	i->src[0] = a;
+	i->src[1] = b;
+	i->args = NULL;
+	i->num_args = 0;
+	i->func = NULL;
+	i->block = NULL;
+	i->prev = NULL;
+	i->next = NULL;
+	return i;
+}
+
+void ir_insn_free(struct ir_insn **ip)
+{
+	if (!ip || !(*ip)) {
+		return;
+	}
+	free((*ip)->args);
+	free(*ip);
+	*ip = 0;
+}
+
+void ir_append(struct block *b, struct ir_insn *i)
+{
+	i->block = b;
+	i->prev = b->last;
+	i->next = NULL;
+	if (b->last) {
+		b->last->next = i;
+	} else {
+		b->first = i;
+	}
+	b->last = i;
+}
+
+/* links i in just before the insn before */
+void ir_insert(struct ir_insn *before, struct ir_insn *i)
+{
+	i->block = before->block;
+	i->prev = before->prev;
+	i->next = before;
+	if (before->prev) {
+		before->prev->next = i;
+	} else {
+		before->block->first = i;
+	}
+	before->prev = i;
+}
+
+/* unlinks i from its block and frees it */
+void ir_remove(struct ir_insn *i)
+{
+	struct block *b = i->block;
+	if (i->prev) {
+		i->prev->next = i->next;
+	} else {
+		b->first = i->next;
+	}
+	if (i->next) {
+		i->next->prev = i->prev;
+	} else {
+		b->last = i->prev;
+	}
+	ir_insn_free(&i);
+}
+
+int block_num_succs(struct block *b)
+{
+	return b->succ[1] ? 2 : b->succ[0] ? 1 : 0;
+}
+
+void block_free(struct block **bp)
+{
+	if (!bp || !(*bp)) {
+		return;
+	}
+	struct block *b = *bp;
+	struct ir_insn *i, *next;
+	for (i = b->first; i; i = next) {
+		next = i->next;
+		ir_insn_free(&i);
+	}
+	free(b->preds);
+	free(b);
+	*bp = 0;
+}
+
+void ir_free(struct ir_func **fp)
+{
+	if (!fp || !(*fp)) {
+		return;
+	}
+	struct ir_func *f = *fp;
+	struct block *b, *next;
+	for (b = f->entry; b; b = next) {
+		next = b->next;
+		block_free(&b);
+	}
+	free(f->regs);
+	free(f->slots);
+	ir_free(&f->next);
+	free(f);
+	*fp = 0;
+}
+
+/* a block that only jumps somewhere else, or NULL */
+static struct block *forwards_to(struct block *b)
+{
+	if (b->first == b->last && b->first && b->first->op == IR_JUMP && b->succ[0] != b) {
+		return b->succ[0];
+	}
+	return NULL;
+}
+
+/*
+tidies the graph and recomputes every block's preds: edges into blocks that only jump are sent
+straight to the jump's target, branches whose arms agree become jumps, and blocks that can no
+longer be reached from the entry are deleted. blocks are then numbered in layout order.
+*/
+void ir_cfg(struct ir_func *f)
+{
+	struct block *b, *to, **bp, **stack;
+	int i, hops, top = 0, *seen;
+	for (b = f->entry; b; b = b->next) {
+		for (i = 0; i < block_num_succs(b); ++i) {
+			for (hops = 0; (to = forwards_to(b->succ[i])) && hops < f->num_blocks; ++hops) {
+				b->succ[i] = to;
+			}
+		}
+		if (b->last && b->last->op == IR_BRANCH && b->succ[0] == b->succ[1]) {
+			b->last->op = IR_JUMP;
+			b->last->src[0] = b->last->src[1] = operand_none();
+			b->succ[1] = NULL;
+		}
+	}
+	
+	seen = calloc(f->num_blocks, sizeof(int));
+	stack = malloc(f->num_blocks * sizeof(struct block *));
+	stack[top++] = f->entry;
+	seen[f->entry->id] = 1;
+	while (top > 0) {
+		b = stack[--top];
+		for (i = 0; i < block_num_succs(b); ++i) {
+			if (!seen[b->succ[i]->id]) {
+				seen[b->succ[i]->id] = 1;
+				stack[top++] = b->succ[i];
+			}
+		}
+	}
+	for (bp = &f->entry; *bp; ) {
+		b = *bp;
+		if (seen[b->id]) {
+			bp = &b->next;
+		} else {
+			*bp = b->next;
+			block_free(&b);
+		}
+	}
+	free(seen);
+	free(stack);
+	
+	f->num_blocks = 0;
+	for (b = f->entry; b; b = b->next) {
+		b->id = f->num_blocks++;
+		free(b->preds);
+		b->preds = NULL;
+		b->num_preds = 0;
+	}
+	for (b = f->entry; b; b = b->next) {
+		for (i = 0; i < block_num_succs(b); ++i) {
+			to = b->succ[i];
+			to->preds = realloc(to->preds, (to->num_preds + 1) * sizeof(struct block *));
+			to->preds[to->num_preds++] = b;
+		}
+	}
+}
+
+static void postorder(struct block *b, struct block **order, int *num, char *seen)
+{
+	int i;
+	seen[b->id] = 1;
+	for (i = 0; i < block_num_succs(b); ++i) {
+		if (!seen[b->succ[i]->id]) {
+			postorder(b->succ[i], order, num, seen);
+		}
+	}
+	order[(*num)++] = b;
+}
+
+/*
+sets every block's idom by Cooper, Harvey and Kennedy's iteration: blocks are visited in reverse
+postorder, and a block's dominator is where the dominator chains of its processed preds meet.
+*/
+void ir_dominators(struct ir_func *f)
+{
+	struct block **order = malloc(f->num_blocks * sizeof(struct block *)), *b, *d, *x, *y;
+	char *seen = calloc(f->num_blocks, 1);
+	int *rank = malloc(f->num_blocks * sizeof(int));
+	int i, n, num = 0, changed = 1;
+	postorder(f->entry, order, &num, seen);
+	for (i = 0; i < num; ++i) {
+		rank[order[i]->id] = i;
+		order[i]->idom = NULL;
+	}
+	f->entry->idom = f->entry;
+	while (changed) {
+		changed = 0;
+		for (i = num - 2; i >= 0; --i) {
+			b = order[i];
+			d = NULL;
+			for (n = 0; n < b->num_preds; ++n) {
+				if (!b->preds[n]->idom) {
+					continue;
+				}
+				for (x = b->preds[n], y = d; y && x != y; ) {
+					while (rank[x->id] < rank[y->id]) {
+						x = x->idom;
+					}
+					while (rank[y->id] < rank[x->id]) {
+						y = y->idom;
+					}
+				}
+				d = x;
+			}
+			if (d != b->idom) {
+				b->idom = d;
+				changed = 1;
+			}
+		}
+	}
+	f->entry->idom = NULL;
+	free(order);
+	free(seen);
+	free(rank);
+}
+
+int ir_dominates(struct block *a, struct block *b)
+{
+	for (; b; b = b->idom) {
+		if (b == a) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static void renumber(struct operand *o, int *map, struct ir_func *f)
+{
+	if (o->kind != OPERAND_TEMP) {
+		return;
+	}
+	if (map[o->value] < 0) {
+		map[o->value] = f->num_temps++;
+	}
+	o->value = map[o->value];
+}
+
+/* numbers the temps still in use from 0, in order of appearance */
+void ir_renumber(struct ir_func *f)
+{
+	struct block *b;
+	struct ir_insn *i;
+	int n, *map = malloc(f->num_temps * sizeof(int));
+	for (n = 0; n < f->num_temps; ++n) {
+		map[n] = -1;
+	}
+	f->num_temps = 0;
+	for (b = f->entry; b; b = b->next) {
+		for (i = b->first; i; i = i->next) {
+			renumber(&i->dst, map, f);
+			renumber(&i->src[0], map, f);
+			renumber(&i->src[1], map, f);
+			for (n = 0; n < i->num_args; ++n) {
+				renumber(&i->args[n], map, f);
+			}
+		}
+	}
+	free(map);
+}
+
+void ir_lower(struct prog *prog, struct config *cfg)
+{
+	strings = prog->strings;
+	ir_free(&prog->ir);
+	funcs_tail = &prog->ir;
+	lower_decl(prog->ast);
+}
+
+/*
+lowering keeps the tree's evaluation order. blocks are laid out as they are placed, and the
+block being filled is current; after a jump, branch or return current is NULL until the next
+block is placed, and anything lowered in between lands in a block nothing reaches. while loops
+keep the tree backends' shape, with the test after the body.
+*/
+static struct ir_func *func;
+static struct block *current;
+static struct block *layout_tail;
+
+struct block *block_make(struct ir_func *f)
+{
+	struct block *b = NEW(block);
+	b->id = f->num_blocks++;
+	b->first = b->last = NULL;
+	b->succ[0] = b->succ[1] = NULL;
+	b->preds = NULL;
+	b->num_preds = 0;
+	b->idom = NULL;
+	b->next = NULL;
+	return b;
+}
+
+static struct ir_insn *emit(struct ir_insn *i);
+
+/* makes b current and lays it out next, falling into it from the
+   previous block if that block is still open */
+static void place(struct block *b)
+{
+	if (current) {
+		emit(ir_insn_make(IR_JUMP, operand_none(), operand_none(), operand_none()));
+		current->succ[0] = b;
+	}
+	if (layout_tail) {
+		layout_tail->next = b;
+	} else {
+		func->entry = b;
+	}
+	layout_tail = b;
+	current = b;
+}
+
+struct ir_insn *emit(struct ir_insn *i)
+{
+	if (!current) {
+		place(block_make(func));
+	}
+	ir_append(current, i);
+	return i;
+}
+
+static void jump(struct block *b)
+{
+	emit(ir_insn_make(IR_JUMP, operand_none(), operand_none(), operand_none()));
+	current->succ[0] = b;
+	current = NULL;
+}
+
+static struct operand assign(struct symbol *, struct expr *);
+
+static void branch(enum ir_op cmp, struct operand a, struct operand b, struct block *t, struct block *f)
+{
+	struct ir_insn *i = emit(ir_insn_make(IR_BRANCH, operand_none(), a, b));
+	i->cmp = cmp;
+	current->succ[0] = t;
+	current->succ[1] = f;
+	current = NULL;
+}
+
+void lower_decl(struct decl *d)
+{
+	if (!d) {
+		return;
+	}
+	
+	switch (d->symbol->kind) {
+	case SYMBOL_GLOBAL:
+		if (d->type->kind == TYPE_FUNCTION && d->code) {
+			func = NEW(ir_func);
+			func->decl = d;
+			func->entry = NULL;
+			func->num_blocks = 0;
+			func->num_temps = 0;
+			func->regs = NULL;
+			func->slots = NULL;
+			func->num_slots = 0;
+			func->next = NULL;
+			current = layout_tail = NULL;
+			place(block_make(func));
+			lower_stmt(d->code);
+			/* falling off the end returns 0, as in the tree backends */
+			emit(ir_insn_make(IR_RETURN, operand_none(), operand_const(0, TYPE_INT), operand_none()));
+			current = NULL;
+			ir_cfg(func);
+			*funcs_tail = func;
+			funcs_tail = &func->next;
+		}
+		break;
+	case SYMBOL_PARAM:
+		break;
+	case SYMBOL_LOCAL:
+		if (d->value) {
+			assign(d->symbol, d->value);
+		}
+		break;
+	}
+	
+	lower_decl(d->next);
+}
+
+void lower_stmt(struct stmt *s)
+{
+	if (!s) {
+		return;
+	}
+	
+	struct block *body, *ebody, *test, *end;
+	struct operand v;
+	struct expr *e;
+	switch (s->kind) {
+	case STMT_DECL:
+		lower_decl(s->decl);
+		break;
+	case STMT_EXPR:
+		lower_expr(s->expr);
+		break;
+	case STMT_IF_ELSE:
+		body = block_make(func);
+		ebody = block_make(func);
+		end = block_make(func);
+		lower_cond(s->expr, body, ebody);
+		place(body);
+		lower_stmt(s->body);
+		if (current) {
+			jump(end);
+		}
+		place(ebody);
+		lower_stmt(s->ebody);
+		place(end);
+		break;
+	case STMT_WHILE:
+		body = block_make(func);
+		test = block_make(func);
+		end = block_make(func);
+		jump(test);
+		place(body);
+		lower_stmt(s->body);
+		place(test);
+		lower_cond(s->expr, body, end);
+		place(end);
+		break;
+	case STMT_RETURN:
+		v = s->expr ? lower_expr(s->expr) : operand_const(0, TYPE_INT);
+		emit(ir_insn_make(IR_RETURN, operand_none(), v, operand_none()));
+		current = NULL;
+		break;
+	case STMT_BLOCK:
+		lower_stmt(s->body);
+		break;
+	case STMT_PRINT:
+		for (e = s->expr; e; e = e->right) {
+			v = lower_expr(e->left);
+			emit(ir_insn_make(IR_PRINT, operand_none(), v, operand_none()));
+		}
+		emit(ir_insn_make(IR_PRINT, operand_none(), operand_const('\n', TYPE_CHAR), operand_none()));
+		break;
+	}
+	
+	lower_stmt(s->next);
+}
+
+static enum ir_op ir_op_from_expr(enum expr_kind kind)
+{
+	switch (kind) {
+	case EXPR_LE:
+		return IR_LE;
+	case EXPR_LT:
+		return IR_LT;
+	case EXPR_EQ:
+		return IR_EQ;
+	case EXPR_NE:
+		return IR_NE;
+	case EXPR_GT:
+		return IR_GT;
+	case EXPR_GE:
+		return IR_GE;
+	case EXPR_NOT:
+		return IR_NOT;
+	case EXPR_NEG:
+		return IR_NEG;
+	case EXPR_ADD:
+		return IR_ADD;
+	case EXPR_SUB:
+		return IR_SUB;
+	case EXPR_MUL:
+		return IR_MUL;
+	case EXPR_DIV:
+		return IR_DIV;
+	case EXPR_MOD:
+		return IR_MOD;
+	default:
+		return IR_POW;
+	}
+}
+
+/* a variable operand is read when its insn runs, so one evaluated
+   before something that may write it is copied out first */
+static struct operand snapshot(struct operand v, struct expr *later)
+{
+	if (v.kind != OPERAND_VAR || !expr_has_effects(later)) {
+		return v;
+	}
+	struct operand t = operand_temp(func, v.type);
+	emit(ir_insn_make(IR_COPY, t, v, operand_none()));
+	return t;
+}
+
+static struct operand assign(struct symbol *s, struct expr *value)
+{
+	struct operand v = lower_expr(value);
+	struct ir_insn *last = current ? current->last : NULL;
+	/* compute straight into the variable rather than through a temp */
+	if (v.kind == OPERAND_TEMP && last && last->op != IR_COPY && operand_eq(last->dst, v)) {
+		last->dst = operand_var(s);
+	} else {
+		emit(ir_insn_make(IR_COPY, operand_var(s), v, operand_none()));
+	}
+	return operand_var(s);
+}
+
+static struct operand lower_call(struct expr *e)
+{
+	struct operand *args = NULL, dst = operand_none();
+	struct expr *arg;
+	int n = 0;
+	for (arg = e->right; arg; arg = arg->right) {
+		args = realloc(args, (n + 1) * sizeof(struct operand));
+		args[n++] = snapshot(lower_expr(arg->left), arg->right);
+	}
+	if (e->symbol->type->rtype->kind != TYPE_VOID) {
+		dst = operand_temp(func, e->symbol->type->rtype->kind);
+	}
+	struct ir_insn *i = emit(ir_insn_make(IR_CALL, dst, operand_none(), operand_none()));
+	i->args = args;
+	i->num_args = n;
+	i->func = e->symbol;
+	return dst;
+}
+
+/* the value of a && b or a || b, with b only evaluated if a doesn't
+   decide it */
+static struct operand lower_logical(struct expr *e)
+{
+	struct block *right = block_make(func), *end = block_make(func);
+	struct operand t = operand_temp(func, TYPE_BOOLEAN);
+	struct operand zero = operand_const(0, TYPE_BOOLEAN);
+	emit(ir_insn_make(IR_COPY, t, lower_expr(e->left), operand_none()));
+	if (e->kind == EXPR_AND) {
+		branch(IR_NE, t, zero, right, end);
+	} else {
+		branch(IR_NE, t, zero, end, right);
+	}
+	place(right);
+	emit(ir_insn_make(IR_COPY, t, lower_expr(e->right), operand_none()));
+	place(end);
+	return t;
+}
+
+struct operand lower_expr(struct expr *e)
+{
+	struct operand v, a, b, one = operand_const(1, TYPE_INT);
+	int *ip;
+	switch (e->kind) {
+	case EXPR_INT:
+	case EXPR_CHAR:
+	case EXPR_BOOLEAN:
+		return operand_const(e->constant, expr_to_type_kind(e));
+	case EXPR_STRING:
+		v = operand_none();
+		v.kind = OPERAND_STRING;
+		v.type = TYPE_STRING;
+		ip = hash_table_lookup(strings, e->name);
+		v.value = *ip;
+		v.name = e->name;
+		return v;
+	case EXPR_NAME:
+		return operand_var(e->symbol);
+	case EXPR_ASSIGN:
+		return assign(e->symbol, e->right);
+	case EXPR_PRE_INCR:
+	case EXPR_PRE_DECR:
+		v = operand_var(e->right->symbol);
+		emit(ir_insn_make(e->kind == EXPR_PRE_INCR ? IR_ADD : IR_SUB, v, v, one));
+		return v;
+	case EXPR_POST_INCR:
+	case EXPR_POST_DECR:
+		v = operand_var(e->left->symbol);
+		a = operand_temp(func, TYPE_INT);
+		emit(ir_insn_make(IR_COPY, a, v, operand_none()));
+		emit(ir_insn_make(e->kind == EXPR_POST_INCR ? IR_ADD : IR_SUB, v, v, one));
+		return a;
+	case EXPR_CALL:
+		return lower_call(e);
+	case EXPR_AND:
+	case EXPR_OR:
+		return lower_logical(e);
+	case EXPR_POS:
+		return lower_expr(e->right);
+	case EXPR_NOT:
+	case EXPR_NEG:
+		a = lower_expr(e->right);
+		v = operand_temp(func, expr_to_type_kind(e));
+		emit(ir_insn_make(ir_op_from_expr(e->kind), v, a, operand_none()));
+		return v;
+	default:
+		a = snapshot(lower_expr(e->left), e->right);
+		b = lower_expr(e->right);
+		v = operand_temp(func, expr_to_type_kind(e));
+		emit(ir_insn_make(ir_op_from_expr(e->kind), v, a, b));
+		return v;
+	}
+}
+
+/* branches to t if e holds and to f otherwise */
+void lower_cond(struct expr *e, struct block *t, struct block *f)
+{
+	struct block *right;
+	struct operand a, b;
+	switch (e->kind) {
+	case EXPR_LE:
+	case EXPR_LT:
+	case EXPR_EQ:
+	case EXPR_NE:
+	case EXPR_GT:
+	case EXPR_GE:
+		a = snapshot(lower_expr(e->left), e->right);
+		b = lower_expr(e->right);
+		branch(ir_op_from_expr(e->kind), a, b, t, f);
+		break;
+	case EXPR_NOT:
+		lower_cond(e->right, f, t);
+		break;
+	case EXPR_AND:
+		right = block_make(func);
+		lower_cond(e->left, right, f);
+		place(right);
+		lower_cond(e->right, t, f);
+		break;
+	case EXPR_OR:
+		right = block_make(func);
+		lower_cond(e->left, t, right);
+		place(right);
+		lower_cond(e->right, t, f);
+		break;
+	case EXPR_BOOLEAN:
+		jump(e->constant ? t : f);
+		break;
+	default:
+		a = lower_expr(e);
+		branch(IR_NE, a, operand_const(0, a.type), t, f);
+		break;
+	}
+}
+
+static FILE *fout;
+
+static void write(const char *fmt, ...)
+{
+	va_list argp;
+	va_start(argp, fmt);
+	vfprintf(fout, fmt, argp);
+	fputc('\n', fout);
+	va_end(argp);
+}
+
+static char *operand_to_s(char *buffer, struct operand o)
+{
+	switch (o.kind) {
+	case OPERAND_NONE:
+		buffer[0] = '\0';
+		break;
+	case OPERAND_TEMP:
+		sprintf(buffer, "%%%d", o.value);
+		break;
+	case OPERAND_VAR:
+		sprintf(buffer, "%s", o.symbol->name);
+		break;
+	case OPERAND_CONST:
+		if (o.type == TYPE_BOOLEAN) {
+			sprintf(buffer, "%s", o.value ? "true" : "false");
+		} else {
+			sprintf(buffer, "%d", o.value);
+		}
+		break;
+	case OPERAND_STRING:
+		sprintf(buffer, "%s", o.name);
+		break;
+	}
+	return buffer;
+}
+
+static void print_insn(struct ir_insn *i)
+{
+	char d[256], a[256], b[256], args[1024];
+	int n;
+	operand_to_s(d, i->dst);
+	operand_to_s(a, i->src[0]);
+	operand_to_s(b, i->src[1]);
+	switch (i->op) {
+	case IR_COPY:
+		write("\t%s = %s", d, a);
+		break;
+	case IR_NEG:
+	case IR_NOT:
+		write("\t%s = %s%s", d, ir_op_to_s(i->op), a);
+		break;
+	case IR_PHI:
+		args[0] = '\0';
+		for (n = 0; n < i->num_args; ++n) {
+			sprintf(args + strlen(args), "%s%s b%d", n ? ", " : "", operand_to_s(a, i->args[n]),
+			        i->block->preds[n]->id);
+		}
+		write("\t%s = phi(%s)", d, args);
+		break;
+	case IR_CALL:
+		args[0] = '\0';
+		for (n = 0; n < i->num_args; ++n) {
+			strcat(args, n ? ", " : "");
+			strcat(args, operand_to_s(a, i->args[n]));
+		}
+		if (i->dst.kind != OPERAND_NONE) {
+			write("\t%s = call %s(%s)", d, i->func->name, args);
+		} else {
+			write("\tcall %s(%s)", i->func->name, args);
+		}
+		break;
+	case IR_PRINT:
+	case IR_RETURN:
+		write("\t%s %s", ir_op_to_s(i->op), a);
+		break;
+	case IR_JUMP:
+		write("\tjump b%d", i->block->succ[0]->id);
+		break;
+	case IR_BRANCH:
+		write("\tif %s %s %s goto b%d else b%d", a, ir_op_to_s(i->cmp), b,
+		      i->block->succ[0]->id, i->block->succ[1]->id);
+		break;
+	default:
+		write("\t%s = %s %s %s", d, a, ir_op_to_s(i->op), b);
+		break;
+	}
+}
+
+void ir_print(struct prog *prog, struct config *cfg)
+{
+	struct ir_func *f;
+	struct block *b;
+	struct ir_insn *i;
+	char preds[256];
+	int n;
+	fout = cfg->fout;
+	for (f = prog->ir; f; f = f->next) {
+		write("%s:", f->decl->name);
+		for (b = f->entry; b; b = b->next) {
+			preds[0] = '\0';
+			for (n = 0; n < b->num_preds && strlen(preds) < 200; ++n) {
+				sprintf(preds + strlen(preds), " b%d", b->preds[n]->id);
+			}
+			if (b->num_preds) {
+				write("b%d:\t\t# preds%s", b->id, preds);
+			} else {
+				write("b%d:", b->id);
+			}
+			for (i = b->first; i; i = i->next) {
+				print_insn(i);
+			}
+		}
+	}
+}
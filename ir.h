@@ -0,0 +1,120 @@
+#ifndef IR_INCLUDED
+#define IR_INCLUDED
+#include "ast.h"
+
+enum ir_op {
+	IR_COPY,
+	IR_NEG,
+	IR_NOT,
+	IR_ADD,
+	IR_SUB,
+	IR_MUL,
+	IR_DIV,
+	IR_MOD,
+	IR_POW,
+	IR_LE,
+	IR_LT,
+	IR_EQ,
+	IR_NE,
+	IR_GT,
+	IR_GE,
+	IR_CALL,
+	IR_PRINT,
+	IR_RETURN,
+	IR_JUMP,
+	IR_BRANCH,
+	IR_PHI
+};
+
+extern const char *ir_op_to_s(enum ir_op op);
+
+enum operand_kind {
+	OPERAND_NONE,
+	OPERAND_TEMP,
+	OPERAND_VAR,
+	OPERAND_CONST,
+	OPERAND_STRING
+};
+
+struct operand {
+	enum operand_kind kind;
+	enum type_kind type;
+	int value; /* temp number, constant or string label */
+	struct symbol *symbol; /* variables */
+	const char *name; /* string literals, as written */
+};
+
+/* d = a op b; branches compare a and b with cmp and go to succ[0] if
+   that holds and succ[1] otherwise. a phi at the top of a block takes
+   args[n] when entered from preds[n] */
+struct ir_insn {
+	enum ir_op op;
+	enum ir_op cmp;
+	struct operand dst;
+	struct operand src[2];
+	struct operand *args; /* calls and phis */
+	int num_args;
+	struct symbol *func; /* calls */
+	struct block *block;
+	struct ir_insn *prev;
+	struct ir_insn *next;
+};
+
+extern struct ir_insn *ir_insn_make(enum ir_op op, struct operand dst, struct operand a, struct operand b);
+extern void ir_insn_free(struct ir_insn **ip);
+extern void ir_append(struct block *b, struct ir_insn *i);
+extern void ir_insert(struct ir_insn *before, struct ir_insn *i);
+extern void ir_remove(struct ir_insn *i);
+
+/* a basic block: straight-line insns, ending in a jump, branch or
+   return, listed in the order codegen lays blocks out */
+struct block {
+	int id;
+	struct ir_insn *first;
+	struct ir_insn *last;
+	struct block *succ[2];
+	struct block **preds;
+	int num_preds;
+	struct block *idom; /* set by ir_dominators */
+	struct block *next;
+};
+
+extern int block_num_succs(struct block *b);
+extern void block_free(struct block **bp);
+
+struct ir_func {
+	struct decl *decl;
+	struct block *entry;
+	int num_blocks;
+	int num_temps;
+	/* where ir_alloc put each temp: a register, or else a spill slot */
+	enum reg *regs;
+	int *slots;
+	int num_slots;
+	struct ir_func *next;
+};
+
+extern struct block *block_make(struct ir_func *f);
+extern int ir_fold(enum ir_op op, int a, int b, int *result);
+extern int ir_calls(struct ir_insn *i);
+extern struct operand operand_none(void);
+extern struct operand operand_temp(struct ir_func *f, enum type_kind type);
+extern struct operand operand_const(int value, enum type_kind type);
+extern int operand_eq(struct operand a, struct operand b);
+extern void ir_cfg(struct ir_func *f);
+extern void ir_dominators(struct ir_func *f);
+extern int ir_dominates(struct block *a, struct block *b);
+extern void ir_renumber(struct ir_func *f);
+extern void ir_free(struct ir_func **fp);
+
+extern void ir_lower(struct prog *prog, struct config *cfg);
+extern void ir_print(struct prog *prog, struct config *cfg);
+extern void ir_ssa(struct prog *prog, struct config *cfg);
+extern void ir_sccp(struct prog *prog, struct config *cfg);
+extern void ir_gvn(struct prog *prog, struct config *cfg);
+extern void ir_licm(struct prog *prog, struct config *cfg);
+extern void ir_iv(struct prog *prog, struct config *cfg);
+extern void ir_unssa(struct prog *prog, struct config *cfg);
+extern void ir_alloc(struct prog *prog, struct config *cfg);
+extern void ir_codegen(struct prog *prog, struct config *cfg);
+#endif
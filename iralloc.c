@@ -0,0 +1,313 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ir.h"
+
+static void alloc_func(struct ir_func *);
+
+static const struct target *target;
+
+void ir_alloc(struct prog *prog, struct config *cfg)
+{
+	struct ir_func *f;
+	target = cfg->target;
+	for (f = prog->ir; f; f = f->next) {
+		alloc_func(f);
+	}
+}
+
+/*
+linear scan: every temp gets one interval, from its first to its last appearance in layout
+order, stretched over any block it is live into or out of. intervals are handed registers in
+order of start and the one reaching furthest is spilled to a frame slot when none is free.
+a temp live across a call may only take a callee-saved register, and one live across a
+division, or used by one, may not take %edx. a temp computed from one that dies there takes its
+register when it can, so copies and two-address ops have nothing to move.
+*/
+static int num_temps;
+static int *start;
+static int *end;
+static enum reg *avoid;
+static int *hint;
+
+#define TEMP(o) ((o).kind == OPERAND_TEMP ? (o).value : -1)
+
+static void extend(int t, int pos)
+{
+	if (t < 0) {
+		return;
+	}
+	if (pos < start[t]) {
+		start[t] = pos;
+	}
+	if (pos > end[t]) {
+		end[t] = pos;
+	}
+}
+
+/* calls func(temp) for each temp i reads */
+static void uses(struct ir_insn *i, void (*func)(int, int), int arg)
+{
+	int n;
+	for (n = 0; n < 2; ++n) {
+		if (i->src[n].kind == OPERAND_TEMP) {
+			func(i->src[n].value, arg);
+		}
+	}
+	for (n = 0; n < i->num_args; ++n) {
+		if (i->args[n].kind == OPERAND_TEMP) {
+			func(i->args[n].value, arg);
+		}
+	}
+}
+
+static int divides(struct ir_insn *i)
+{
+	return i->op == IR_DIV || i->op == IR_MOD;
+}
+
+/* per-block liveness, as one byte per temp */
+static char **live_in;
+static char **use_set;
+static char **def_set;
+static char *set;
+
+static void mark_use(int t, int b)
+{
+	if (!def_set[b][t]) {
+		use_set[b][t] = 1;
+	}
+}
+
+static void mark(int t, int unused)
+{
+	set[t] = 1;
+}
+
+static void liveness(struct ir_func *f)
+{
+	struct block *b;
+	struct ir_insn *i;
+	int n, k, changed = 1;
+	live_in = malloc(f->num_blocks * sizeof(char *));
+	use_set = malloc(f->num_blocks * sizeof(char *));
+	def_set = malloc(f->num_blocks * sizeof(char *));
+	for (b = f->entry; b; b = b->next) {
+		live_in[b->id] = calloc(num_temps + 1, 1);
+		use_set[b->id] = calloc(num_temps + 1, 1);
+		def_set[b->id] = calloc(num_temps + 1, 1);
+		for (i = b->first; i; i = i->next) {
+			uses(i, mark_use, b->id);
+			if (TEMP(i->dst) >= 0) {
+				def_set[b->id][i->dst.value] = 1;
+			}
+		}
+	}
+	set = malloc(num_temps + 1);
+	while (changed) {
+		changed = 0;
+		for (b = f->entry; b; b = b->next) {
+			/* in = use + (out - def) */
+			memset(set, 0, num_temps);
+			for (n = 0; n < block_num_succs(b); ++n) {
+				for (k = 0; k < num_temps; ++k) {
+					set[k] |= live_in[b->succ[n]->id][k];
+				}
+			}
+			for (k = 0; k < num_temps; ++k) {
+				char in = use_set[b->id][k] || (set[k] && !def_set[b->id][k]);
+				if (in != live_in[b->id][k]) {
+					live_in[b->id][k] = in;
+					changed = 1;
+				}
+			}
+		}
+	}
+}
+
+/* the temp whose register d = a op b would best reuse, or -1 */
+static int source(struct ir_insn *i)
+{
+	switch (i->op) {
+	case IR_ADD:
+	case IR_MUL:
+		if (TEMP(i->src[0]) < 0) {
+			return TEMP(i->src[1]);
+		}
+		/* fall through */
+	case IR_COPY:
+	case IR_NEG:
+	case IR_NOT:
+	case IR_SUB:
+		return TEMP(i->src[0]);
+	default:
+		return -1;
+	}
+}
+
+static void build_intervals(struct ir_func *f)
+{
+	struct block *b;
+	struct ir_insn *i;
+	int n, k, pos = 0, first;
+	for (k = 0; k < num_temps; ++k) {
+		start[k] = 0x7fffffff;
+		end[k] = -1;
+		avoid[k] = 0;
+		hint[k] = -1;
+	}
+	for (b = f->entry; b; b = b->next) {
+		first = pos;
+		for (k = 0; k < num_temps; ++k) {
+			if (live_in[b->id][k]) {
+				extend(k, first);
+			}
+		}
+		for (i = b->first; i; i = i->next, pos += 2) {
+			memset(set, 0, num_temps);
+			uses(i, mark, 0);
+			for (k = 0; k < num_temps; ++k) {
+				if (set[k]) {
+					extend(k, pos);
+				}
+			}
+			extend(TEMP(i->dst), pos);
+		}
+		/* live out of b: live into a successor */
+		for (n = 0; n < block_num_succs(b); ++n) {
+			for (k = 0; k < num_temps; ++k) {
+				if (live_in[b->succ[n]->id][k]) {
+					extend(k, pos - 1);
+				}
+			}
+		}
+	}
+	
+	pos = 0;
+	for (b = f->entry; b; b = b->next) {
+		for (i = b->first; i; i = i->next, pos += 2) {
+			if (TEMP(i->dst) >= 0 && hint[i->dst.value] < 0) {
+				hint[i->dst.value] = source(i);
+			}
+			if (!ir_calls(i) && !divides(i)) {
+				continue;
+			}
+			for (k = 0; k < num_temps; ++k) {
+				if (ir_calls(i) && start[k] < pos && end[k] > pos) {
+					avoid[k] |= target->caller_saved;
+				}
+				if (divides(i) && start[k] < pos && end[k] >= pos) {
+					avoid[k] |= REG_EDX;
+				}
+			}
+		}
+	}
+}
+
+static int by_start(const void *a, const void *b)
+{
+	int x = *(const int *)a, y = *(const int *)b;
+	return start[x] != start[y] ? start[x] - start[y] : x - y;
+}
+
+static void spill(struct ir_func *f, int t)
+{
+	f->regs[t] = 0;
+	f->slots[t] = f->num_slots++;
+}
+
+void alloc_func(struct ir_func *f)
+{
+	int *order, *active, num_active = 0, n, k, j, t, victim;
+	enum reg free_regs, reg;
+	num_temps = f->num_temps;
+	start = malloc((num_temps + 1) * sizeof(int));
+	end = malloc((num_temps + 1) * sizeof(int));
+	avoid = malloc((num_temps + 1) * sizeof(enum reg));
+	hint = malloc((num_temps + 1) * sizeof(int));
+	liveness(f);
+	build_intervals(f);
+	
+	free(f->regs);
+	free(f->slots);
+	f->regs = calloc(num_temps + 1, sizeof(enum reg));
+	f->slots = malloc((num_temps + 1) * sizeof(int));
+	f->num_slots = 0;
+	f->decl->regs = 0;
+	order = malloc((num_temps + 1) * sizeof(int));
+	active = malloc((num_temps + 1) * sizeof(int));
+	for (n = 0; n < num_temps; ++n) {
+		order[n] = n;
+		f->slots[n] = -1;
+	}
+	qsort(order, num_temps, sizeof(int), by_start);
+	
+	free_regs = 0;
+	for (n = 0; n < target->num_regs; ++n) {
+		free_regs |= target->regs[n];
+	}
+	for (n = 0; n < num_temps; ++n) {
+		t = order[n];
+		if (end[t] < 0) {
+			continue;
+		}
+		/* an interval ending where t starts is read before t is written */
+		for (k = 0; k < num_active; ) {
+			if (end[active[k]] <= start[t]) {
+				free_regs |= f->regs[active[k]];
+				active[k] = active[--num_active];
+			} else {
+				++k;
+			}
+		}
+		reg = 0;
+		j = hint[t];
+		if (j >= 0 && (free_regs & f->regs[j] & ~avoid[t])) {
+			reg = f->regs[j];
+		}
+		for (k = 0; k < target->num_regs && !reg; ++k) {
+			if (free_regs & target->regs[k] & ~avoid[t]) {
+				reg = target->regs[k];
+				break;
+			}
+		}
+		if (!reg) {
+			victim = -1;
+			for (k = 0; k < num_active; ++k) {
+				j = active[k];
+				if (!(f->regs[j] & avoid[t]) && end[j] > end[t] &&
+				    (victim < 0 || end[j] > end[active[victim]])) {
+					victim = k;
+				}
+			}
+			if (victim < 0) {
+				spill(f, t);
+				continue;
+			}
+			reg = f->regs[active[victim]];
+			spill(f, active[victim]);
+			active[victim] = active[--num_active];
+			free_regs |= reg;
+		}
+		f->regs[t] = reg;
+		f->decl->regs |= reg;
+		free_regs &= ~reg;
+		active[num_active++] = t;
+	}
+	
+	for (n = 0; n < f->num_blocks; ++n) {
+		free(live_in[n]);
+		free(use_set[n]);
+		free(def_set[n]);
+	}
+	free(live_in);
+	free(use_set);
+	free(def_set);
+	free(set);
+	free(order);
+	free(active);
+	free(start);
+	free(end);
+	free(avoid);
+	free(hint);
+}
@@ -0,0 +1,878 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include "ir.h"
+#include "hash_table.h"
+
+static void gen_decl(struct decl *);
+static void gen_func(struct ir_func *);
+static void gen_insn(struct ir_insn *);
+
+static struct hash_table *strings;
+static FILE *fout;
+static FILE *ferr;
+static const struct target *target;
+static int x64;
+static int omit_frame_pointer;
+static struct ir_func *funcs;
+
+/* the function being generated, kept until its peephole pass */
+static struct insn *insns;
+static struct insn **insns_tail;
+
+static void write(const char *fmt, ...)
+{
+	char line[256];
+	va_list argp;
+	va_start(argp, fmt);
+	vsnprintf(line, sizeof(line), fmt, argp);
+	va_end(argp);
+	if (insns_tail) {
+		*insns_tail = insn_make(line);
+		insns_tail = &(*insns_tail)->next;
+	} else {
+		fprintf(fout, "%s\n", line);
+	}
+}
+
+static void flush(void)
+{
+	insns_tail = NULL;
+	insns = peephole(insns, target, NULL);
+	insn_print(fout, insns);
+	insn_free(&insns);
+}
+
+/* both targets come through here: x86-64 differs in its register
+   names, its 8 byte strings and slots, and passing args in registers */
+void ir_codegen(struct prog *prog, struct config *cfg)
+{
+	char *s;
+	int *ip;
+	strings = prog->strings;
+	fout = cfg->fout;
+	ferr = cfg->ferr;
+	target = cfg->target;
+	x64 = target == &target_x86_64;
+	omit_frame_pointer = cfg->flags & FLAG_OMIT_FRAME_POINTER;
+	funcs = prog->ir;
+	write("\t.text");
+	hash_table_firstkey(strings);
+	while (hash_table_nextkey(strings, &s, (void **)&ip)) {
+		write(".string%d:", *ip);
+		write("\t.string\t%s", s);
+	}
+	gen_decl(prog->ast);
+}
+
+void gen_decl(struct decl *d)
+{
+	if (!d) {
+		return;
+	}
+	
+	int *ip;
+	if (d->type->kind == TYPE_FUNCTION) {
+		if (d->code) {
+			gen_func(funcs);
+			funcs = funcs->next;
+		}
+	} else {
+		write("\t.data");
+		if (x64 && d->type->kind == TYPE_STRING) {
+			write("\t.align\t8");
+		}
+		write(".globl %s", d->name);
+		write("%s:", d->name);
+		if (d->type->kind == TYPE_STRING && d->value) {
+			ip = hash_table_lookup(strings, d->value->name);
+			write("\t.%s\t.string%d", x64 ? "quad" : "long", *ip);
+		} else if (d->type->kind == TYPE_STRING) {
+			write("\t.%s\t0", x64 ? "quad" : "long");
+		} else {
+			write("\t.long\t%d", d->value ? d->value->constant : 0);
+		}
+	}
+	
+	gen_decl(d->next);
+}
+
+static const char *reg_name(enum reg reg, int size)
+{
+	static const char *names[][3] = {
+		{ "%al", "%eax", "%rax" },
+		{ "%bl", "%ebx", "%rbx" },
+		{ "%cl", "%ecx", "%rcx" },
+		{ "%dl", "%edx", "%rdx" },
+		{ "%sil", "%esi", "%rsi" },
+		{ "%dil", "%edi", "%rdi" },
+		{ "%r8b", "%r8d", "%r8" },
+		{ "%r9b", "%r9d", "%r9" },
+		{ "%r10b", "%r10d", "%r10" },
+		{ "%r11b", "%r11d", "%r11" },
+		{ "%r12b", "%r12d", "%r12" },
+		{ "%r13b", "%r13d", "%r13" },
+		{ "%r14b", "%r14d", "%r14" },
+		{ "%r15b", "%r15d", "%r15" }
+	};
+	static const enum reg regs[] = {
+		REG_EAX, REG_EBX, REG_ECX, REG_EDX, REG_ESI, REG_EDI, REG_R8, REG_R9,
+		REG_R10, REG_R11, REG_R12, REG_R13, REG_R14, REG_R15
+	};
+	int i;
+	for (i = 0; regs[i] != reg; ++i);
+	return names[i][size == 1 ? 0 : size == 4 ? 1 : 2];
+}
+
+/*
+frame, from the top: on x86-64 the homes of register params, spill slots, locals, a scratch
+slot, one save slot per callee-saved register used, and the outgoing args. %esp/%rsp stays put
+between prologue and epilogue, so without a frame pointer everything is a fixed offset from it.
+a param arriving in a register is only stored to its home (on i386, its slot among the caller's
+args) if it is read from there; the copies ir_ssa leaves at the entry take it straight from the
+register instead.
+*/
+static struct ir_func *func;
+static int word;
+static int use_sp;
+static int red_zone;
+static int frame_size;
+static int out_size;
+static int scratch;
+static int locals_base;
+static int spills_base;
+static int params_base;
+static int num_locals;
+static int homed; /* bit n: register param n is read from its home */
+static struct ir_insn *body; /* the first insn after the entry copies */
+static enum reg save_set;
+
+#define SIZE(o) (x64 && (o).type == TYPE_STRING ? 8 : 4)
+#define SUFFIX(size) ((size) == 8 ? 'q' : 'l')
+
+/* the register a function gets arg n in; the runtime's all come on the stack on i386 */
+static enum reg arg_in(struct symbol *func_symbol, int n)
+{
+	return func_symbol || x64 ? arg_reg(target, func_symbol, n) : 0;
+}
+
+static int entry_copy(struct ir_insn *i)
+{
+	return i->op == IR_COPY && i->dst.kind == OPERAND_TEMP && i->src[0].kind == OPERAND_VAR &&
+	       i->src[0].symbol->kind == SYMBOL_PARAM && arg_in(func->decl->symbol, i->src[0].symbol->offset);
+}
+
+static void note_var(struct operand o, int copy)
+{
+	if (o.kind != OPERAND_VAR) {
+		return;
+	}
+	if (o.symbol->kind == SYMBOL_LOCAL && o.symbol->offset >= num_locals) {
+		num_locals = o.symbol->offset + 1;
+	} else if (o.symbol->kind == SYMBOL_PARAM && !copy && arg_in(func->decl->symbol, o.symbol->offset)) {
+		homed |= 1 << o.symbol->offset;
+	}
+}
+
+static int out_words(struct ir_insn *i)
+{
+	switch (i->op) {
+	case IR_CALL:
+		return x64 ? i->num_args - target->num_arg_regs : i->num_args;
+	case IR_PRINT:
+		return x64 ? 0 : 1;
+	case IR_POW:
+		return x64 ? 0 : 2;
+	default:
+		return 0;
+	}
+}
+
+static void frame_layout(struct ir_func *f)
+{
+	struct block *b;
+	struct ir_insn *i;
+	int n, num_homes = 0, any_calls = 0;
+	out_size = 0;
+	scratch = -1;
+	num_locals = 0;
+	homed = 0;
+	for (body = f->entry->first; body && entry_copy(body); body = body->next);
+	for (b = f->entry; b; b = b->next) {
+		for (i = b == f->entry ? body : b->first; i; i = i->next) {
+			note_var(i->dst, 0);
+			note_var(i->src[0], 0);
+			note_var(i->src[1], 0);
+			for (n = 0; n < i->num_args; ++n) {
+				note_var(i->args[n], 0);
+			}
+			if (ir_calls(i)) {
+				any_calls = 1;
+				if (out_words(i) * word > out_size) {
+					out_size = out_words(i) * word;
+				}
+			}
+			if ((i->op == IR_DIV || i->op == IR_MOD) && i->src[1].kind == OPERAND_CONST &&
+			    i->src[1].value < 2) {
+				scratch = 0;
+			}
+		}
+	}
+	for (n = 0; n < target->num_arg_regs; ++n) {
+		if (homed & (1 << n)) {
+			num_homes = n + 1;
+		}
+	}
+	save_set = f->decl->regs & target->callee_saved;
+	frame_size = out_size;
+	for (n = 0; n < target->num_regs; ++n) {
+		if (save_set & target->regs[n]) {
+			frame_size += word;
+		}
+	}
+	if (scratch == 0) {
+		scratch = frame_size;
+		frame_size += word;
+	}
+	locals_base = frame_size;
+	spills_base = locals_base + num_locals * word;
+	params_base = spills_base + f->num_slots * word;
+	frame_size = params_base + (x64 ? num_homes * word : 0);
+	/* leaf functions never need a frame pointer */
+	use_sp = omit_frame_pointer || !any_calls;
+	red_zone = x64 && !any_calls && frame_size <= 128;
+	/* the return address (and saved frame pointer) count toward alignment */
+	if (x64 && any_calls && (frame_size + (use_sp ? 8 : 16)) % 16) {
+		frame_size += 8;
+	}
+}
+
+static void frame_loc(char *buffer, int offset)
+{
+	const char *sp = x64 ? "%rsp" : "%esp", *fp = x64 ? "%rbp" : "%ebp";
+	if (!use_sp) {
+		sprintf(buffer, "%d(%s)", offset - frame_size, fp);
+	} else if (red_zone) {
+		sprintf(buffer, "%d(%s)", offset - frame_size, sp);
+	} else {
+		sprintf(buffer, "%d(%s)", offset, sp);
+	}
+}
+
+static void param_loc(char *buffer, int n)
+{
+	int above = frame_size + (use_sp ? word : 2 * word);
+	if (!x64) {
+		frame_loc(buffer, above + n * word);
+	} else if (n < target->num_arg_regs) {
+		frame_loc(buffer, params_base + n * word);
+	} else {
+		frame_loc(buffer, above + (n - target->num_arg_regs) * word);
+	}
+}
+
+static void var_loc(char *buffer, struct symbol *s)
+{
+	switch (s->kind) {
+	case SYMBOL_GLOBAL:
+		sprintf(buffer, x64 ? "%s(%%rip)" : "%s", s->name);
+		break;
+	case SYMBOL_PARAM:
+		param_loc(buffer, s->offset);
+		break;
+	case SYMBOL_LOCAL:
+		frame_loc(buffer, locals_base + s->offset * word);
+		break;
+	}
+}
+
+/* the register holding o, or 0 */
+static enum reg reg_of(struct operand o)
+{
+	return o.kind == OPERAND_TEMP ? func->regs[o.value] : 0;
+}
+
+/* constants, and on i386 string addresses, can be immediates */
+static int is_imm(struct operand o)
+{
+	return o.kind == OPERAND_CONST || (o.kind == OPERAND_STRING && !x64);
+}
+
+static int is_mem(struct operand o)
+{
+	return o.kind == OPERAND_VAR || (o.kind == OPERAND_TEMP && !reg_of(o));
+}
+
+static char *loc(char *buffer, struct operand o)
+{
+	switch (o.kind) {
+	case OPERAND_TEMP:
+		if (reg_of(o)) {
+			strcpy(buffer, reg_name(reg_of(o), SIZE(o)));
+		} else {
+			frame_loc(buffer, spills_base + func->slots[o.value] * word);
+		}
+		break;
+	case OPERAND_VAR:
+		var_loc(buffer, o.symbol);
+		break;
+	case OPERAND_CONST:
+		sprintf(buffer, "$%d", o.value);
+		break;
+	case OPERAND_STRING:
+		sprintf(buffer, "$.string%d", o.value);
+		break;
+	default:
+		buffer[0] = '\0';
+		break;
+	}
+	return buffer;
+}
+
+static void load(struct operand o, enum reg reg)
+{
+	char buffer[256];
+	int size = SIZE(o);
+	if (o.kind == OPERAND_STRING && x64) {
+		write("\tleaq\t.string%d(%%rip), %s", o.value, reg_name(reg, 8));
+	} else if (reg_of(o) != reg) {
+		write("\tmov%c\t%s, %s", SUFFIX(size), loc(buffer, o), reg_name(reg, size));
+	}
+}
+
+static void store(enum reg reg, struct operand o)
+{
+	char buffer[256];
+	int size = SIZE(o);
+	if (reg_of(o) != reg) {
+		write("\tmov%c\t%s, %s", SUFFIX(size), reg_name(reg, size), loc(buffer, o));
+	}
+}
+
+/* moves between two memory operands go through %eax */
+static void move(struct operand from, struct operand to)
+{
+	char a[256], b[256];
+	if (operand_eq(from, to) || (reg_of(from) && reg_of(from) == reg_of(to))) {
+		return;
+	}
+	if (reg_of(to)) {
+		load(from, reg_of(to));
+	} else if (reg_of(from) || is_imm(from)) {
+		write("\tmov%c\t%s, %s", SUFFIX(SIZE(to)), loc(a, from), loc(b, to));
+	} else {
+		load(from, REG_EAX);
+		store(REG_EAX, to);
+	}
+}
+
+/* the register to compute d in: its own, unless b lives there */
+static enum reg work_reg(struct operand d, struct operand b)
+{
+	if (reg_of(d) && reg_of(d) != reg_of(b)) {
+		return reg_of(d);
+	}
+	return REG_EAX;
+}
+
+static const char *cmp_cc(enum ir_op cmp, int sense)
+{
+	switch (cmp) {
+	case IR_LE:
+		return sense ? "le" : "g";
+	case IR_LT:
+		return sense ? "l" : "ge";
+	case IR_EQ:
+		return sense ? "e" : "ne";
+	case IR_NE:
+		return sense ? "ne" : "e";
+	case IR_GT:
+		return sense ? "g" : "le";
+	case IR_GE:
+		return sense ? "ge" : "l";
+	default:
+		return NULL;
+	}
+}
+
+static enum ir_op swap_cmp(enum ir_op cmp)
+{
+	switch (cmp) {
+	case IR_LE:
+		return IR_GE;
+	case IR_LT:
+		return IR_GT;
+	case IR_GT:
+		return IR_LT;
+	case IR_GE:
+		return IR_LE;
+	default:
+		return cmp;
+	}
+}
+
+/* whether a cmp b is known here, setting *result if so */
+static int cmp_known(enum ir_op cmp, struct operand a, struct operand b, int *result)
+{
+	if (a.kind == OPERAND_STRING && b.kind == OPERAND_STRING) {
+		*result = (a.value == b.value) == (cmp == IR_EQ);
+		return 1;
+	}
+	return a.kind == OPERAND_CONST && b.kind == OPERAND_CONST && ir_fold(cmp, a.value, b.value, result);
+}
+
+/* sets the flags for a cmp b, returning the comparison they hold for,
+   which is mirrored if the operands had to be swapped */
+static enum ir_op gen_cmp(enum ir_op cmp, struct operand a, struct operand b)
+{
+	char x[256], y[256];
+	int size = SIZE(a) > SIZE(b) ? SIZE(a) : SIZE(b);
+	struct operand t;
+	if (is_imm(a) || (a.kind == OPERAND_STRING && b.kind != OPERAND_STRING)) {
+		t = a;
+		a = b;
+		b = t;
+		cmp = swap_cmp(cmp);
+	}
+	if (b.kind == OPERAND_STRING && x64) {
+		load(b, REG_EAX);
+		write("\tcmpq\t%%rax, %s", loc(x, a));
+	} else if (is_imm(a) || (is_mem(a) && is_mem(b))) {
+		load(a, REG_EAX);
+		write("\tcmp%c\t%s, %s", SUFFIX(size), loc(y, b), reg_name(REG_EAX, size));
+	} else {
+		write("\tcmp%c\t%s, %s", SUFFIX(size), loc(y, b), loc(x, a));
+	}
+	return cmp;
+}
+
+static const char *block_label(char *buffer, struct block *b)
+{
+	sprintf(buffer, ".%s.b%d", func->decl->name, b->id);
+	return buffer;
+}
+
+static void gen_jump(struct block *from, struct block *to)
+{
+	char label[256];
+	if (from->next != to) {
+		write("\tjmp\t%s", block_label(label, to));
+	}
+}
+
+static void gen_branch(struct ir_insn *i)
+{
+	struct block *b = i->block, *t = b->succ[0], *f = b->succ[1];
+	char label[256];
+	enum ir_op cmp;
+	int known;
+	if (cmp_known(i->cmp, i->src[0], i->src[1], &known)) {
+		gen_jump(b, known ? t : f);
+		return;
+	}
+	cmp = gen_cmp(i->cmp, i->src[0], i->src[1]);
+	if (b->next == t) {
+		write("\tj%s\t%s", cmp_cc(cmp, 0), block_label(label, f));
+	} else {
+		write("\tj%s\t%s", cmp_cc(cmp, 1), block_label(label, t));
+		gen_jump(b, f);
+	}
+}
+
+static void gen_setcc(struct ir_insn *i)
+{
+	enum ir_op cmp;
+	int known;
+	if (cmp_known(i->op, i->src[0], i->src[1], &known)) {
+		move(operand_const(known, TYPE_BOOLEAN), i->dst);
+		return;
+	}
+	cmp = gen_cmp(i->op, i->src[0], i->src[1]);
+	write("\tset%s\t%%al", cmp_cc(cmp, 1));
+	if (reg_of(i->dst)) {
+		write("\tmovzbl\t%%al, %s", reg_name(reg_of(i->dst), 4));
+	} else {
+		write("\tmovzbl\t%%al, %%eax");
+		store(REG_EAX, i->dst);
+	}
+}
+
+/* d = a op b, two-address, swapping the operands of + and * if that
+   saves going through %eax */
+static void gen_arith(struct ir_insn *i, const char *op)
+{
+	struct operand a = i->src[0], b = i->src[1], d = i->dst;
+	char buffer[256];
+	enum reg w;
+	int k;
+	if (i->op != IR_SUB && ((reg_of(b) && reg_of(b) == reg_of(d)) || is_imm(a))) {
+		a = i->src[1];
+		b = i->src[0];
+	}
+	w = work_reg(d, b);
+	if (i->op == IR_MUL && b.kind == OPERAND_CONST && a.kind != OPERAND_CONST) {
+		k = log2_exact(b.value);
+		if (k > 0) {
+			load(a, w);
+			write("\tshll\t$%d, %s", k, reg_name(w, 4));
+		} else {
+			write("\timull\t$%d, %s, %s", b.value, loc(buffer, a), reg_name(w, 4));
+		}
+	} else {
+		load(a, w);
+		write("\t%s\t%s, %s", op, loc(buffer, b), reg_name(w, 4));
+	}
+	store(w, d);
+}
+
+static void gen_unary(struct ir_insn *i)
+{
+	enum reg w = work_reg(i->dst, operand_none());
+	load(i->src[0], w);
+	if (i->op == IR_NEG) {
+		write("\tnegl\t%s", reg_name(w, 4));
+	} else {
+		write("\txorl\t$1, %s", reg_name(w, 4));
+	}
+	store(w, i->dst);
+}
+
+/* unsigned division by a constant: a shift or mask for powers of two,
+   otherwise a multiply by the reciprocal (see div_magic) */
+static void gen_divconst(struct ir_insn *i)
+{
+	struct operand a = i->src[0], d = i->dst;
+	unsigned c = i->src[1].value;
+	int k = log2_exact(c);
+	struct div_magic m;
+	enum reg w, q;
+	char x[256];
+	if (a.kind == OPERAND_CONST) {
+		move(operand_const(i->op == IR_DIV ? (unsigned)a.value / c : (unsigned)a.value % c, TYPE_INT), d);
+		return;
+	}
+	if (k >= 0) {
+		w = work_reg(d, operand_none());
+		load(a, w);
+		if (i->op == IR_DIV) {
+			write("\tshrl\t$%d, %s", k, reg_name(w, 4));
+		} else {
+			write("\tandl\t$%u, %s", c - 1, reg_name(w, 4));
+		}
+		store(w, d);
+		return;
+	}
+	div_magic(c, &m);
+	loc(x, a);
+	write("\tmovl\t$%d, %%eax", (int)m.mul);
+	write("\tmull\t%s", x);
+	if (m.add) {
+		write("\tmovl\t%s, %%eax", x);
+		write("\tsubl\t%%edx, %%eax");
+		write("\tshrl\t$1, %%eax");
+		write("\taddl\t%%edx, %%eax");
+		q = REG_EAX;
+	} else {
+		q = REG_EDX;
+	}
+	if (m.shift) {
+		write("\tshrl\t$%d, %s", m.shift, reg_name(q, 4));
+	}
+	if (i->op == IR_DIV) {
+		store(q, d);
+		return;
+	}
+	write("\timull\t$%u, %s, %%edx", c, reg_name(q, 4));
+	write("\tmovl\t%s, %%eax", x);
+	write("\tsubl\t%%edx, %%eax");
+	store(REG_EAX, d);
+}
+
+/* the dividend is zero-extended into %edx:%eax, as in the tree backends */
+static void gen_div(struct ir_insn *i)
+{
+	struct operand b = i->src[1];
+	char buffer[256];
+	if (b.kind == OPERAND_CONST && b.value >= 2) {
+		gen_divconst(i);
+		return;
+	}
+	load(i->src[0], REG_EAX);
+	write("\tmovl\t$0, %%edx");
+	if (b.kind == OPERAND_CONST) {
+		frame_loc(buffer, scratch);
+		write("\tmovl\t$%d, %s", b.value, buffer);
+	} else {
+		loc(buffer, b);
+	}
+	write("\tidivl\t%s", buffer);
+	store(i->op == IR_DIV ? REG_EAX : REG_EDX, i->dst);
+}
+
+/* square and multiply from the top bit down, with x left where it is */
+static void gen_pow(struct ir_insn *i)
+{
+	struct operand a = i->src[0];
+	int y = i->src[1].value, bit = 1;
+	char buffer[256];
+	if (y <= 0 || a.kind == OPERAND_CONST) {
+		move(operand_const(power(a.value, y), TYPE_INT), i->dst);
+		return;
+	}
+	while (bit * 2 <= y) {
+		bit *= 2;
+	}
+	load(a, REG_EAX);
+	for (bit /= 2; bit; bit /= 2) {
+		write("\timull\t%%eax, %%eax");
+		if (y & bit) {
+			write("\timull\t%s, %%eax", loc(buffer, a));
+		}
+	}
+	store(REG_EAX, i->dst);
+}
+
+static int move_blocked(enum reg *from, enum reg *to, int n, int i)
+{
+	int j;
+	for (j = 0; j < n; ++j) {
+		if (j != i && to[j] && from[j] == to[i]) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* moves every from[i] into to[i] at once; a cycle is broken by parking
+   one value in %eax */
+static void parallel_move(enum reg *from, enum reg *to, int n)
+{
+	int i, pending = n, moved;
+	while (pending > 0) {
+		moved = 0;
+		for (i = 0; i < n; ++i) {
+			if (!to[i]) {
+				continue;
+			}
+			if (from[i] != to[i]) {
+				if (move_blocked(from, to, n, i)) {
+					continue;
+				}
+				write("\tmov%c\t%s, %s", SUFFIX(word), reg_name(from[i], word), reg_name(to[i], word));
+			}
+			to[i] = 0;
+			--pending;
+			moved = 1;
+		}
+		if (!moved) {
+			i = 0;
+			while (!to[i]) {
+				++i;
+			}
+			write("\tmov%c\t%s, %s", SUFFIX(word), reg_name(from[i], word), reg_name(REG_EAX, word));
+			from[i] = REG_EAX;
+		}
+	}
+}
+
+/* stack args first, then the register args: those held in registers
+   are shuffled into place before the rest are loaded over them */
+static void gen_args(struct operand *args, int num_args, struct symbol *func_symbol)
+{
+	enum reg from[6], to[6], reg;
+	char buffer[256], value[256];
+	int n, k = 0, size;
+	for (n = 0; n < num_args; ++n) {
+		if (arg_in(func_symbol, n)) {
+			continue;
+		}
+		size = SIZE(args[n]);
+		frame_loc(buffer, (x64 ? n - target->num_arg_regs : n) * word);
+		if (reg_of(args[n]) || is_imm(args[n])) {
+			write("\tmov%c\t%s, %s", SUFFIX(size), loc(value, args[n]), buffer);
+		} else {
+			load(args[n], REG_EAX);
+			write("\tmov%c\t%s, %s", SUFFIX(size), reg_name(REG_EAX, size), buffer);
+		}
+	}
+	for (n = 0; n < num_args; ++n) {
+		reg = arg_in(func_symbol, n);
+		if (reg && reg_of(args[n])) {
+			from[k] = reg_of(args[n]);
+			to[k++] = reg;
+		}
+	}
+	parallel_move(from, to, k);
+	for (n = 0; n < num_args; ++n) {
+		reg = arg_in(func_symbol, n);
+		if (reg && !reg_of(args[n])) {
+			load(args[n], reg);
+		}
+	}
+}
+
+static void gen_call(const char *name, struct operand *args, int num_args, struct symbol *func_symbol, struct operand dst)
+{
+	gen_args(args, num_args, func_symbol);
+	write("\tcall\t%s", name);
+	if (dst.kind != OPERAND_NONE) {
+		store(REG_EAX, dst);
+	}
+}
+
+static void gen_print(struct operand a)
+{
+	char name[32], buffer[256], value[256];
+	sprintf(name, "print_%s", type_kind_to_s(a.type));
+	if (x64) {
+		load(a, REG_EDI);
+	} else {
+		frame_loc(buffer, 0);
+		if (is_mem(a)) {
+			load(a, REG_EAX);
+			write("\tmovl\t%%eax, %s", buffer);
+		} else {
+			write("\tmovl\t%s, %s", loc(value, a), buffer);
+		}
+	}
+	write("\tcall\t%s", name);
+}
+
+void gen_insn(struct ir_insn *i)
+{
+	char buffer[256];
+	switch (i->op) {
+	case IR_COPY:
+		move(i->src[0], i->dst);
+		break;
+	case IR_NEG:
+	case IR_NOT:
+		gen_unary(i);
+		break;
+	case IR_ADD:
+		gen_arith(i, "addl");
+		break;
+	case IR_SUB:
+		gen_arith(i, "subl");
+		break;
+	case IR_MUL:
+		gen_arith(i, "imull");
+		break;
+	case IR_DIV:
+	case IR_MOD:
+		gen_div(i);
+		break;
+	case IR_POW:
+		if (!ir_calls(i)) {
+			gen_pow(i);
+		} else {
+			gen_call("power", i->src, 2, NULL, i->dst);
+		}
+		break;
+	case IR_LE:
+	case IR_LT:
+	case IR_EQ:
+	case IR_NE:
+	case IR_GT:
+	case IR_GE:
+		gen_setcc(i);
+		break;
+	case IR_CALL:
+		gen_call(i->func->name, i->args, i->num_args, i->func, i->dst);
+		break;
+	case IR_PRINT:
+		gen_print(i->src[0]);
+		break;
+	case IR_RETURN:
+		load(i->src[0], REG_EAX);
+		if (i->block->next) {
+			sprintf(buffer, ".%s.ret", func->decl->name);
+			write("\tjmp\t%s", buffer);
+		}
+		break;
+	case IR_JUMP:
+		gen_jump(i->block, i->block->succ[0]);
+		break;
+	case IR_BRANCH:
+		gen_branch(i);
+		break;
+	case IR_PHI:
+		fprintf(ferr, "codegen: phi left in %s\n", func->decl->name);
+		exit(1);
+	}
+}
+
+static void save_regs(int restore)
+{
+	char buffer[64];
+	int n, offset = out_size;
+	for (n = 0; n < target->num_regs; ++n) {
+		if (!(save_set & target->regs[n])) {
+			continue;
+		}
+		frame_loc(buffer, offset);
+		if (restore) {
+			write("\tmov%c\t%s, %s", SUFFIX(word), buffer, reg_name(target->regs[n], word));
+		} else {
+			write("\tmov%c\t%s, %s", SUFFIX(word), reg_name(target->regs[n], word), buffer);
+		}
+		offset += word;
+	}
+}
+
+void gen_func(struct ir_func *f)
+{
+	struct decl *d = f->decl;
+	struct block *b;
+	struct ir_insn *i;
+	enum reg from[6], to[6];
+	char buffer[256];
+	const char *sp = x64 ? "%rsp" : "%esp", *fp = x64 ? "%rbp" : "%ebp";
+	int n, k = 0;
+	func = f;
+	word = x64 ? 8 : 4;
+	frame_layout(f);
+	write("\t.text");
+	insns_tail = &insns;
+	write(".globl %s", d->name);
+	write("%s:", d->name);
+	if (!use_sp) {
+		write("\tpush%c\t%s", SUFFIX(word), fp);
+		write("\tmov%c\t%s, %s", SUFFIX(word), sp, fp);
+	}
+	if (frame_size > 0 && !red_zone) {
+		write("\tsub%c\t$%d, %s", SUFFIX(word), frame_size, sp);
+	}
+	save_regs(0);
+	for (n = 0; n < target->num_arg_regs; ++n) {
+		if (homed & (1 << n)) {
+			param_loc(buffer, n);
+			write("\tmov%c\t%s, %s", SUFFIX(word), reg_name(arg_in(d->symbol, n), word), buffer);
+		}
+	}
+	for (i = f->entry->first; i != body; i = i->next) {
+		if (reg_of(i->dst)) {
+			from[k] = arg_in(d->symbol, i->src[0].symbol->offset);
+			to[k++] = reg_of(i->dst);
+		} else {
+			store(arg_in(d->symbol, i->src[0].symbol->offset), i->dst);
+		}
+	}
+	parallel_move(from, to, k);
+	for (b = f->entry; b; b = b->next) {
+		write("%s:", block_label(buffer, b));
+		for (i = b == f->entry ? body : b->first; i; i = i->next) {
+			gen_insn(i);
+		}
+	}
+	write(".%s.ret:", d->name);
+	save_regs(1);
+	if (!use_sp) {
+		write("\tleave");
+	} else if (frame_size > 0 && !red_zone) {
+		write("\tadd%c\t$%d, %s", SUFFIX(word), frame_size, sp);
+	}
+	write("\tret");
+	flush();
+}
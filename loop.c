@@ -0,0 +1,642 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ir.h"
+
+static void licm_func(struct ir_func *);
+static void iv_func(struct ir_func *);
+
+void ir_licm(struct prog *prog, struct config *cfg)
+{
+	struct ir_func *f;
+	if (cfg->opt_level == 0) {
+		return;
+	}
+	for (f = prog->ir; f; f = f->next) {
+		licm_func(f);
+	}
+}
+
+void ir_iv(struct prog *prog, struct config *cfg)
+{
+	struct ir_func *f;
+	if (cfg->opt_level == 0) {
+		return;
+	}
+	for (f = prog->ir; f; f = f->next) {
+		iv_func(f);
+	}
+}
+
+/*
+a natural loop is found from each edge into a block that dominates its source, and spans what
+reaches that edge without passing through the block, its header. edges sharing a header make
+one loop. loops are taken innermost first, so what leaves an inner loop can go on to leave the
+outer one too.
+*/
+struct loop {
+	struct block *header;
+	struct block **latches;
+	int num_latches;
+	int size;
+};
+
+static struct loop *loops;
+static int num_loops;
+static char *body;
+static struct block **stack;
+
+/* marks the blocks of l in body, returning how many there are */
+static int loop_body(struct ir_func *f, struct loop *l)
+{
+	struct block *b;
+	int n, top = 0, size = 1;
+	free(body);
+	free(stack);
+	body = calloc(f->num_blocks, 1);
+	stack = malloc(f->num_blocks * sizeof(struct block *));
+	body[l->header->id] = 1;
+	for (n = 0; n < l->num_latches; ++n) {
+		if (!body[l->latches[n]->id]) {
+			body[l->latches[n]->id] = 1;
+			stack[top++] = l->latches[n];
+			++size;
+		}
+	}
+	while (top > 0) {
+		b = stack[--top];
+		for (n = 0; n < b->num_preds; ++n) {
+			if (!body[b->preds[n]->id]) {
+				body[b->preds[n]->id] = 1;
+				stack[top++] = b->preds[n];
+				++size;
+			}
+		}
+	}
+	return size;
+}
+
+static int by_size(const void *a, const void *b)
+{
+	return ((const struct loop *)a)->size - ((const struct loop *)b)->size;
+}
+
+static void find_loops(struct ir_func *f)
+{
+	struct block *b, *h;
+	struct loop *l;
+	int n, k;
+	ir_dominators(f);
+	loops = NULL;
+	num_loops = 0;
+	for (b = f->entry; b; b = b->next) {
+		for (n = 0; n < block_num_succs(b); ++n) {
+			h = b->succ[n];
+			if (!ir_dominates(h, b)) {
+				continue;
+			}
+			for (k = 0; k < num_loops && loops[k].header != h; ++k);
+			if (k == num_loops) {
+				loops = realloc(loops, (num_loops + 1) * sizeof(struct loop));
+				loops[k].header = h;
+				loops[k].latches = NULL;
+				loops[k].num_latches = 0;
+				++num_loops;
+			}
+			l = &loops[k];
+			l->latches = realloc(l->latches, (l->num_latches + 1) * sizeof(struct block *));
+			l->latches[l->num_latches++] = b;
+		}
+	}
+	for (n = 0; n < num_loops; ++n) {
+		loops[n].size = loop_body(f, &loops[n]);
+	}
+	if (num_loops > 1) {
+		qsort(loops, num_loops, sizeof(struct loop), by_size);
+	}
+}
+
+static void free_loops(void)
+{
+	int n;
+	for (n = 0; n < num_loops; ++n) {
+		free(loops[n].latches);
+	}
+	free(loops);
+	free(body);
+	free(stack);
+	loops = NULL;
+	body = NULL;
+	stack = NULL;
+	num_loops = 0;
+}
+
+/*
+the block entered just before l's header, made if l is entered from more than one block or from
+one that also goes elsewhere. the header's phis then take what arrives from outside through
+phis in the new block.
+*/
+static struct block *preheader(struct ir_func *f, struct loop *l)
+{
+	struct block *h = l->header, *p, *outside = NULL, **preds, *b;
+	struct ir_insn *i, *phi;
+	struct operand *args;
+	int n, k, num_outside = 0;
+	for (n = 0; n < h->num_preds; ++n) {
+		if (!body[h->preds[n]->id]) {
+			outside = h->preds[n];
+			++num_outside;
+		}
+	}
+	if (num_outside == 1 && block_num_succs(outside) == 1) {
+		return outside;
+	}
+	
+	p = block_make(f);
+	body = realloc(body, f->num_blocks);
+	body[p->id] = 0;
+	ir_append(p, ir_insn_make(IR_JUMP, operand_none(), operand_none(), operand_none()));
+	p->succ[0] = h;
+	p->preds = malloc((num_outside + 1) * sizeof(struct block *));
+	preds = malloc((h->num_preds - num_outside + 1) * sizeof(struct block *));
+	preds[0] = p;
+	for (n = 0, k = 1; n < h->num_preds; ++n) {
+		b = h->preds[n];
+		if (body[b->id]) {
+			preds[k++] = b;
+			continue;
+		}
+		p->preds[p->num_preds++] = b;
+		b->succ[b->succ[0] == h ? 0 : 1] = p;
+	}
+	for (i = h->first; i && i->op == IR_PHI; i = i->next) {
+		phi = ir_insn_make(IR_PHI, operand_temp(f, i->dst.type), operand_none(), operand_none());
+		phi->args = malloc((num_outside + 1) * sizeof(struct operand));
+		args = malloc((h->num_preds - num_outside + 1) * sizeof(struct operand));
+		args[0] = phi->dst;
+		for (n = 0, k = 1; n < h->num_preds; ++n) {
+			if (body[h->preds[n]->id]) {
+				args[k++] = i->args[n];
+			} else {
+				phi->args[phi->num_args++] = i->args[n];
+			}
+		}
+		ir_insert(p->last, phi);
+		free(i->args);
+		i->args = args;
+		i->num_args = k;
+	}
+	free(h->preds);
+	h->preds = preds;
+	h->num_preds = h->num_preds - num_outside + 1;
+	
+	/* laid out just ahead of the header */
+	p->next = h;
+	if (h == f->entry) {
+		f->entry = p;
+	} else {
+		for (b = f->entry; b->next != h; b = b->next);
+		b->next = p;
+	}
+	return p;
+}
+
+/*
+an insn is invariant in a loop when everything it reads is: a constant, a temp computed outside
+the loop or by an insn already hoisted, or a global the loop never stores to or calls anything
+that might. invariant insns go to the end of the preheader, where they run once whether or not
+the loop does, so a division goes only if it cannot trap there: by a constant other than 0 and
+-1, or from the header, which runs whenever the preheader does, ahead of any output.
+*/
+static struct block **def_block;
+static struct ir_insn **def_insn;
+static int num_defs;
+static struct symbol **written;
+static int num_written;
+static int calls;
+
+static void write_set(struct ir_func *f)
+{
+	struct block *b;
+	struct ir_insn *i;
+	int n;
+	free(def_block);
+	free(def_insn);
+	def_block = calloc(f->num_temps + 1, sizeof(struct block *));
+	def_insn = calloc(f->num_temps + 1, sizeof(struct ir_insn *));
+	num_defs = f->num_temps;
+	num_written = 0;
+	calls = 0;
+	for (b = f->entry; b; b = b->next) {
+		for (i = b->first; i; i = i->next) {
+			if (i->dst.kind == OPERAND_TEMP) {
+				def_block[i->dst.value] = b;
+				def_insn[i->dst.value] = i;
+			}
+			if (!body[b->id]) {
+				continue;
+			}
+			calls |= i->op == IR_CALL;
+			if (i->dst.kind == OPERAND_VAR && i->dst.symbol->kind == SYMBOL_GLOBAL) {
+				for (n = 0; n < num_written && written[n] != i->dst.symbol; ++n);
+				if (n == num_written) {
+					written = realloc(written, (num_written + 1) * sizeof(struct symbol *));
+					written[num_written++] = i->dst.symbol;
+				}
+			}
+		}
+	}
+}
+
+static void free_sets(void)
+{
+	free(def_block);
+	free(def_insn);
+	free(written);
+	def_block = NULL;
+	def_insn = NULL;
+	written = NULL;
+	num_written = 0;
+}
+
+static int invariant(struct operand o)
+{
+	int n;
+	switch (o.kind) {
+	case OPERAND_TEMP:
+		/* temps made since write_set are the caller's own */
+		return o.value < num_defs && (!def_block[o.value] || !body[def_block[o.value]->id]);
+	case OPERAND_VAR:
+		if (o.symbol->kind != SYMBOL_GLOBAL || calls) {
+			return 0;
+		}
+		for (n = 0; n < num_written && written[n] != o.symbol; ++n);
+		return n == num_written;
+	default:
+		return 1;
+	}
+}
+
+static int hoistable(struct ir_insn *i, struct loop *l, int effects)
+{
+	struct operand d = i->src[1];
+	if (i->dst.kind != OPERAND_TEMP || !invariant(i->src[0]) || !invariant(i->src[1])) {
+		return 0;
+	}
+	switch (i->op) {
+	case IR_CALL:
+	case IR_PRINT:
+	case IR_PHI:
+		return 0;
+	case IR_DIV:
+	case IR_MOD:
+		return (d.kind == OPERAND_CONST && d.value != 0 && d.value != -1) ||
+		       (i->block == l->header && !effects);
+	default:
+		return 1;
+	}
+}
+
+static void hoist(struct ir_func *f, struct loop *l)
+{
+	struct block *p = NULL, *b;
+	struct ir_insn *i, *next, *h;
+	int effects, changed = 1;
+	loop_body(f, l);
+	write_set(f);
+	while (changed) {
+		changed = 0;
+		for (b = f->entry; b; b = b->next) {
+			if (!body[b->id]) {
+				continue;
+			}
+			effects = 0;
+			for (i = b->first; i; i = next) {
+				next = i->next;
+				if (!hoistable(i, l, effects)) {
+					effects |= ir_calls(i);
+					continue;
+				}
+				if (!p) {
+					p = preheader(f, l);
+				}
+				h = ir_insn_make(i->op, i->dst, i->src[0], i->src[1]);
+				ir_insert(p->last, h);
+				def_block[h->dst.value] = p;
+				ir_remove(i);
+				changed = 1;
+			}
+		}
+	}
+}
+
+void licm_func(struct ir_func *f)
+{
+	int n;
+	find_loops(f);
+	for (n = 0; n < num_loops; ++n) {
+		hoist(f, &loops[n]);
+	}
+	free_loops();
+	free_sets();
+	ir_renumber(f);
+}
+
+/*
+a basic induction variable is a header phi that every trip around the loop steps by a constant:
+what it takes along each back edge is itself plus or minus one. a product of one with an
+invariant is then a derived variable, kept in a phi of its own, started at the preheader and
+stepped by the invariant times the step on each back edge, so the multiply becomes an add.
+multiplying by a power of two is left alone, as a shift costs no more than the add. a variable
+left feeding only its own steps and the loop's exit test is then dropped: the test is put on a
+derived variable instead, with its constant bound scaled, when that cannot overflow.
+*/
+static int *num_uses;
+
+static void count_uses(struct ir_func *f)
+{
+	struct block *b;
+	struct ir_insn *i;
+	int n;
+	free(num_uses);
+	num_uses = calloc(f->num_temps + 1, sizeof(int));
+	for (b = f->entry; b; b = b->next) {
+		for (i = b->first; i; i = i->next) {
+			for (n = 0; n < 2 + i->num_args; ++n) {
+				struct operand o = n < 2 ? i->src[n] : i->args[n - 2];
+				if (o.kind == OPERAND_TEMP) {
+					++num_uses[o.value];
+				}
+			}
+		}
+	}
+}
+
+/* what along a back edge a steps phi by, if it is phi + c or phi - c */
+static int step_of(struct operand a, struct ir_insn *phi, int *c)
+{
+	struct ir_insn *i;
+	if (a.kind != OPERAND_TEMP || a.value >= num_defs || !(i = def_insn[a.value])) {
+		return 0;
+	}
+	if (i->op == IR_ADD && operand_eq(i->src[0], phi->dst) && i->src[1].kind == OPERAND_CONST) {
+		*c = i->src[1].value;
+	} else if (i->op == IR_ADD && operand_eq(i->src[1], phi->dst) && i->src[0].kind == OPERAND_CONST) {
+		*c = i->src[0].value;
+	} else if (i->op == IR_SUB && operand_eq(i->src[0], phi->dst) && i->src[1].kind == OPERAND_CONST) {
+		*c = -(unsigned)i->src[1].value;
+	} else {
+		return 0;
+	}
+	return 1;
+}
+
+/* whether phi, in l's header, is a basic induction variable */
+static int basic(struct ir_insn *phi, struct loop *l)
+{
+	struct block *h = l->header;
+	int n, c;
+	if (phi->dst.type != TYPE_INT) {
+		return 0;
+	}
+	for (n = 0; n < h->num_preds; ++n) {
+		if (body[h->preds[n]->id] && !step_of(phi->args[n], phi, &c)) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/* i = phi * k, for a basic phi in l's header and an invariant k */
+static struct ir_insn *derived(struct ir_insn *i, struct loop *l, struct operand *k)
+{
+	struct ir_insn *phi;
+	int n;
+	if (i->op != IR_MUL || i->dst.type != TYPE_INT) {
+		return NULL;
+	}
+	for (n = 0; n < 2; ++n) {
+		*k = i->src[1 - n];
+		if (i->src[n].kind != OPERAND_TEMP || i->src[n].value >= num_defs || !(phi = def_insn[i->src[n].value]) ||
+		    phi->op != IR_PHI || phi->block != l->header || !invariant(*k) || k->kind == OPERAND_VAR) {
+			continue;
+		}
+		if (k->kind == OPERAND_CONST && (k->value & (k->value - 1)) == 0) {
+			continue;
+		}
+		if (basic(phi, l)) {
+			return phi;
+		}
+	}
+	return NULL;
+}
+
+/* a * b, computed at the end of the preheader p unless that is known already */
+static struct operand times(struct ir_func *f, struct block *p, struct operand a, struct operand b)
+{
+	struct operand d;
+	if (a.kind == OPERAND_CONST && b.kind == OPERAND_CONST) {
+		return operand_const((unsigned)a.value * b.value, TYPE_INT);
+	}
+	if (a.kind == OPERAND_CONST && (a.value == 0 || a.value == 1)) {
+		return a.value ? b : a;
+	}
+	if (b.kind == OPERAND_CONST && (b.value == 0 || b.value == 1)) {
+		return b.value ? a : b;
+	}
+	d = operand_temp(f, TYPE_INT);
+	ir_insert(p->last, ir_insn_make(IR_MUL, d, a, b));
+	return d;
+}
+
+static void replace_uses(struct ir_func *f, struct operand from, struct operand to)
+{
+	struct block *b;
+	struct ir_insn *i;
+	int n;
+	for (b = f->entry; b; b = b->next) {
+		for (i = b->first; i; i = i->next) {
+			for (n = 0; n < 2 + i->num_args; ++n) {
+				struct operand *o = n < 2 ? &i->src[n] : &i->args[n - 2];
+				if (operand_eq(*o, from)) {
+					*o = to;
+				}
+			}
+		}
+	}
+}
+
+/* replaces mul, which is phi * k, by a derived variable, which it returns */
+static struct ir_insn *reduce(struct ir_func *f, struct loop *l, struct block *p, struct ir_insn *mul,
+                              struct ir_insn *phi, struct operand k)
+{
+	struct block *h = l->header, *latch;
+	struct ir_insn *j, *next;
+	int n, c;
+	j = ir_insn_make(IR_PHI, operand_temp(f, TYPE_INT), operand_none(), operand_none());
+	j->args = malloc(h->num_preds * sizeof(struct operand));
+	j->num_args = h->num_preds;
+	for (n = 0; n < h->num_preds; ++n) {
+		latch = h->preds[n];
+		if (!body[latch->id]) {
+			j->args[n] = times(f, p, phi->args[n], k);
+			continue;
+		}
+		step_of(phi->args[n], phi, &c);
+		next = ir_insn_make(IR_ADD, operand_temp(f, TYPE_INT), j->dst, times(f, p, operand_const(c, TYPE_INT), k));
+		ir_insert(latch->last, next);
+		j->args[n] = next->dst;
+	}
+	ir_insert(h->first, j);
+	if (mul->dst.kind == OPERAND_TEMP) {
+		replace_uses(f, mul->dst, j->dst);
+		ir_remove(mul);
+	} else {
+		/* a store to a variable stays, of the derived value */
+		mul->op = IR_COPY;
+		mul->src[0] = j->dst;
+		mul->src[1] = operand_none();
+	}
+	return j;
+}
+
+static enum ir_op swap_cmp(enum ir_op cmp)
+{
+	switch (cmp) {
+	case IR_LE:
+		return IR_GE;
+	case IR_LT:
+		return IR_GT;
+	case IR_GT:
+		return IR_LT;
+	case IR_GE:
+		return IR_LE;
+	default:
+		return cmp;
+	}
+}
+
+/* moves l's exit test from phi onto j = phi * k, dropping phi if nothing else reads it */
+static void replace_test(struct loop *l, struct ir_insn *phi, struct ir_insn *j, int k)
+{
+	struct block *h = l->header;
+	struct ir_insn *br = NULL, *i;
+	long long lo, hi, bound;
+	int n, c, latches = 0, sign = 0, steps = 0;
+	for (n = 0; n < h->num_preds; ++n) {
+		latches += body[h->preds[n]->id];
+	}
+	i = h->last;
+	if (i->op == IR_BRANCH && (operand_eq(i->src[0], phi->dst) || operand_eq(i->src[1], phi->dst))) {
+		br = i;
+	}
+	/* staying in the loop while the test holds keeps the counter within bounds */
+	if (!br || !body[h->succ[0]->id] || body[h->succ[1]->id] || k <= 0 ||
+	    num_uses[phi->dst.value] != latches + 1) {
+		return;
+	}
+	if (operand_eq(br->src[1], phi->dst)) {
+		br->src[1] = br->src[0];
+		br->src[0] = phi->dst;
+		br->cmp = swap_cmp(br->cmp);
+	}
+	if (br->src[1].kind != OPERAND_CONST) {
+		return;
+	}
+	bound = br->src[1].value;
+	lo = hi = bound;
+	for (n = 0; n < h->num_preds; ++n) {
+		if (!body[h->preds[n]->id]) {
+			if (phi->args[n].kind != OPERAND_CONST) {
+				return;
+			}
+			lo = phi->args[n].value < lo ? phi->args[n].value : lo;
+			hi = phi->args[n].value > hi ? phi->args[n].value : hi;
+			continue;
+		}
+		step_of(phi->args[n], phi, &c);
+		if (num_uses[phi->args[n].value] != 1) {
+			return;
+		}
+		sign |= c > 0 ? 1 : c < 0 ? 2 : 3;
+		steps = c < 0 ? -c > steps ? -c : steps : c > steps ? c : steps;
+	}
+	/* the counter must head for the bound, and its multiples all fit */
+	if (!((sign == 1 && (br->cmp == IR_LT || br->cmp == IR_LE)) ||
+	      (sign == 2 && (br->cmp == IR_GT || br->cmp == IR_GE)))) {
+		return;
+	}
+	lo -= steps;
+	hi += steps;
+	if (lo * k < -0x7fffffffLL - 1 || hi * k > 0x7fffffffLL) {
+		return;
+	}
+	br->src[0] = j->dst;
+	br->src[1] = operand_const((int)(bound * k), TYPE_INT);
+	for (n = 0; n < h->num_preds; ++n) {
+		if (body[h->preds[n]->id]) {
+			ir_remove(def_insn[phi->args[n].value]);
+		}
+	}
+	ir_remove(phi);
+}
+
+static void strength(struct ir_func *f, struct loop *l)
+{
+	struct block *p = NULL, *b;
+	struct ir_insn *i, *next, *phi, *j, **phis = NULL, **ivs = NULL;
+	struct operand k;
+	int n, num = 0, *ks = NULL;
+	loop_body(f, l);
+	write_set(f);
+	for (b = f->entry; b; b = b->next) {
+		if (!body[b->id]) {
+			continue;
+		}
+		for (i = b->first; i; i = next) {
+			next = i->next;
+			if (!(phi = derived(i, l, &k))) {
+				continue;
+			}
+			if (!p) {
+				p = preheader(f, l);
+			}
+			j = reduce(f, l, p, i, phi, k);
+			if (k.kind == OPERAND_CONST) {
+				phis = realloc(phis, (num + 1) * sizeof(struct ir_insn *));
+				ivs = realloc(ivs, (num + 1) * sizeof(struct ir_insn *));
+				ks = realloc(ks, (num + 1) * sizeof(int));
+				phis[num] = phi;
+				ivs[num] = j;
+				ks[num++] = k.value;
+			}
+		}
+	}
+	if (num) {
+		count_uses(f);
+		write_set(f);
+	}
+	for (n = 0; n < num; ++n) {
+		for (i = l->header->first; i && i != phis[n]; i = i->next);
+		if (i) {
+			replace_test(l, phis[n], ivs[n], ks[n]);
+		}
+	}
+	free(phis);
+	free(ivs);
+	free(ks);
+}
+
+void iv_func(struct ir_func *f)
+{
+	int n;
+	find_loops(f);
+	for (n = 0; n < num_loops; ++n) {
+		strength(f, &loops[n]);
+	}
+	free_loops();
+	free_sets();
+	free(num_uses);
+	num_uses = NULL;
+	ir_renumber(f);
+}
@@ -4,6 +4,7 @@
 #include <stdarg.h>
 #include "parse.tab.h"
 #include "ast.h"
+#include "ir.h"
 
 enum mode {
 	MODE_ERROR,
@@ -18,6 +19,7 @@ enum mode {
 	MODE_ANNOTATE,
 	MODE_INLINE,
 	MODE_PRUNE,
+	MODE_IR,
 	MODE_ALLOC,
 	MODE_CODEGEN
 };
@@ -40,12 +42,24 @@ int main(int argc, char **argv)
 	yyin = stdin;
 	config.fout = stdout;
 	config.ferr = stderr;
+	config.target = &target_i386;
 	--argc, ++argv;
 	while (argc > 0) {
 		if (*argv[0] == '-') {
 			char *flag = *argv + 1;
 			if (flag[0] == 'O') {
 				opt_level = flag[1] - '0';
+			} else if (!strcmp(flag, "fomit-frame-pointer")) {
+				config.flags |= FLAG_OMIT_FRAME_POINTER;
+			} else if (!strcmp(flag, "fir")) {
+				config.flags |= FLAG_IR;
+			} else if (!strcmp(flag, "fkeep-exports")) {
+				config.flags |= FLAG_KEEP_EXPORTS;
+			} else if (!strncmp(flag, "target=", 7)) {
+				if ((config.target = target_from_s(flag + 7)) == NULL) {
+					fprintf(stderr, "unknown target '%s'\n", flag + 7);
+					exit(1);
+				}
 			} else {
 				mode = get_mode(*argv + 1);
 			}
@@ -110,6 +124,8 @@ enum mode get_mode(const char *arg)
 		return MODE_INLINE;
 	} else if (!strcmp(arg, "prune")) {
 		return MODE_PRUNE;
+	} else if (!strcmp(arg, "ir")) {
+		return MODE_IR;
 	} else if (!strcmp(arg, "allocate")) {
 		return MODE_ALLOC;
 	} else if (!strcmp(arg, "generate")) {
@@ -120,7 +136,7 @@ enum mode get_mode(const char *arg)
 }
 
 static int num_passes;
-static ast_pass passes[16];
+static ast_pass passes[32];
 
 static void passes_init(ast_pass pass, ...)
 {
@@ -150,13 +166,22 @@ static void help(void)
 	       " -canonicalize: modify ast to canonical form and print\n"
 	       " -reduce:       reduce simple expressions and print\n"
 	       " -annotate:     annotate symbols for read/write usage and print summary\n"
-	       " -inline:       inline constant local variables and print\n"
+	       " -inline:       inline calls and constant local variables and print\n"
 	       " -prune:        remove dead code from ast and print\n"
+	       " -ir:           lower to three-address code in ssa form, optimize and print it\n"
 	       " -allocate:     allocate registers to expressions, output only on error\n"
 	       " -generate:     generate assembly code\n"
 	       "\n"
 	       "options:\n"
-	       " -On: cycle through optimization passes (reduce, annotate, inline, prune) n times\n");
+	       " -On: cycle through optimization passes (reduce, annotate, inline, prune,\n"
+	       "      promote) n times\n"
+	       " -fomit-frame-pointer: address params and locals off %%esp in every function\n"
+	       "                       (leaf functions always do)\n"
+	       " -fir: generate code from the three-address ir rather than the ast; with n > 0\n"
+	       "       it is put in ssa form and optimized\n"
+	       " -fkeep-exports: keep every global of a unit when pruning, as if used from\n"
+	       "                 outside; otherwise those main cannot reach are removed\n"
+	       " -target=NAME: generate code for i386 (default) or x86_64\n");
 	exit(0);
 }
 
@@ -220,20 +245,39 @@ void init(void)
 		opt_begin = 3;
 		opt_end = 7;
 		break;
+	case MODE_IR:
+		passes_init(ast_resolve, ast_typecheck, ast_canon, ast_reduce,
+		            ast_annotate, ast_inline, ast_prune, ast_promote, ast_frame, ir_lower,
+		            ir_ssa, ir_sccp, ir_gvn, ir_licm, ir_iv, ir_print, NULL);
+		opt_level = opt_level == 0 ? 1 : opt_level;
+		opt_begin = 3;
+		opt_end = 8;
+		break;
 	case MODE_ALLOC:
 		passes_init(ast_resolve, ast_typecheck, ast_canon, ast_reduce,
-		            ast_annotate, ast_inline, ast_prune, ast_alloc, NULL);
+		            ast_annotate, ast_inline, ast_prune, ast_promote, ast_frame, ast_select,
+		            ast_alloc, NULL);
 		opt_begin = 3;
-		opt_end = 7;
+		opt_end = 8;
 		break;
 	case MODE_CODEGEN:
+		if (config.flags & FLAG_IR) {
+			passes_init(ast_resolve, ast_typecheck, ast_canon, ast_reduce,
+			            ast_annotate, ast_inline, ast_prune, ast_promote, ast_frame, ir_lower,
+			            ir_ssa, ir_sccp, ir_gvn, ir_licm, ir_iv, ir_unssa, ir_alloc, ir_codegen, NULL);
+			opt_begin = 3;
+			opt_end = 8;
+			break;
+		}
 		passes_init(ast_resolve, ast_typecheck, ast_canon, ast_reduce,
-		            ast_annotate, ast_inline, ast_prune, ast_alloc, ast_codegen,
-		            NULL);
+		            ast_annotate, ast_inline, ast_prune, ast_promote, ast_frame, ast_select,
+		            ast_alloc, ast_codegen, NULL);
 		opt_begin = 3;
-		opt_end = 7;
+		opt_end = 8;
 		break;
 	}
+	/* the ir passes run once, after the ast has been cycled through */
+	config.opt_level = opt_level;
 }
 
 void dispatch(void)
@@ -0,0 +1,525 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "ast.h"
+#include "hash_table.h"
+
+#define NEW(t) (malloc(sizeof(struct t)))
+
+static char *copy(const char *s, int n)
+{
+	char *c = malloc(n + 1);
+	memcpy(c, s, n);
+	c[n] = '\0';
+	return c;
+}
+
+/* parses one line as written by codegen: "label:", "\top\targ, arg" or
+   anything else (directives), which is kept verbatim */
+struct insn *insn_make(const char *line)
+{
+	struct insn *i = NEW(insn);
+	int n = strlen(line), depth = 0;
+	const char *p, *start;
+	i->num_args = 0;
+	i->next = NULL;
+	if (line[0] != '\t' && n > 0 && line[n - 1] == ':') {
+		i->kind = INSN_LABEL;
+		i->op = copy(line, n - 1);
+	} else if (line[0] != '\t' || line[1] == '.') {
+		i->kind = INSN_RAW;
+		i->op = copy(line, n);
+	} else {
+		i->kind = INSN_OP;
+		p = line + 1;
+		while (*p && *p != '\t') {
+			++p;
+		}
+		i->op = copy(line + 1, p - line - 1);
+		while (*p && i->num_args < 3) {
+			start = ++p;
+			while (*p && (*p != ',' || depth > 0)) {
+				depth += *p == '(' ? 1 : *p == ')' ? -1 : 0;
+				++p;
+			}
+			i->args[i->num_args++] = copy(start, p - start);
+			if (*p == ',' && p[1] == ' ') {
+				++p;
+			}
+		}
+	}
+	return i;
+}
+
+void insn_print(FILE *f, struct insn *i)
+{
+	int j;
+	for (; i; i = i->next) {
+		switch (i->kind) {
+		case INSN_LABEL:
+			fprintf(f, "%s:\n", i->op);
+			break;
+		case INSN_RAW:
+			fprintf(f, "%s\n", i->op);
+			break;
+		case INSN_OP:
+			fprintf(f, "\t%s", i->op);
+			for (j = 0; j < i->num_args; ++j) {
+				fprintf(f, "%s%s", j ? ", " : "\t", i->args[j]);
+			}
+			fputc('\n', f);
+			break;
+		}
+	}
+}
+
+void insn_free(struct insn **ip)
+{
+	if (!ip || !(*ip)) {
+		return;
+	}
+	struct insn *i = *ip;
+	int j;
+	for (j = 0; j < i->num_args; ++j) {
+		free(i->args[j]);
+	}
+	free(i->op);
+	insn_free(&i->next);
+	free(i);
+	*ip = 0;
+}
+
+static const struct target *target;
+static struct insn **list_head;
+static struct hash_table *callees;
+
+static int is_jump(struct insn *);
+static int is_cond_jump(struct insn *);
+static int is_move(struct insn *);
+static int is_lea(struct insn *);
+static int is_reg(const char *arg);
+static int is_mem(const char *arg);
+static enum reg arg_regs(const char *arg);
+static int reg_live(struct insn *, enum reg);
+static struct insn *label_target(struct insn *list, const char *label);
+static int remove_unreachable(struct insn **);
+static int remove_jumps(struct insn **);
+static int thread_jumps(struct insn *);
+static int remove_moves(struct insn **);
+static int remove_labels(struct insn **);
+
+/*
+local peephole rewrites, repeated until nothing changes:
+- code after an unconditional jump or ret up to the next label is unreachable
+- jumps to the very next instruction go, jumps onto jumps go straight to the final target and
+  "jcc a; jmp b; a:" becomes "jncc b; a:"
+- self moves, reloads of a just-stored value and moves into registers that are never read go,
+  and a move into a register that is copied once and then dies is done directly
+- local labels nothing jumps to go, except the entry points ahead of the first instruction
+*/
+struct insn *peephole(struct insn *list, const struct target *t, struct decl *summaries)
+{
+	struct decl *d;
+	target = t;
+	int changed;
+	list_head = &list;
+	callees = hash_table_create(0, 0);
+	for (d = summaries; d; d = d->next) {
+		if (d->type->kind == TYPE_FUNCTION && d->code) {
+			hash_table_insert(callees, d->name, d->symbol, NULL);
+		}
+	}
+	do {
+		changed = remove_unreachable(&list);
+		changed |= remove_jumps(&list);
+		changed |= thread_jumps(list);
+		changed |= remove_moves(&list);
+		changed |= remove_labels(&list);
+	} while (changed);
+	hash_table_delete(callees);
+	return list;
+}
+
+static void unlink_insn(struct insn **ip)
+{
+	struct insn *i = *ip;
+	*ip = i->next;
+	i->next = NULL;
+	insn_free(&i);
+}
+
+int is_jump(struct insn *i)
+{
+	return i->kind == INSN_OP && i->op[0] == 'j';
+}
+
+int is_cond_jump(struct insn *i)
+{
+	return is_jump(i) && strcmp(i->op, "jmp");
+}
+
+int is_move(struct insn *i)
+{
+	return i->kind == INSN_OP && (!strcmp(i->op, "movl") || !strcmp(i->op, "movq"));
+}
+
+int is_lea(struct insn *i)
+{
+	return i->kind == INSN_OP && (!strcmp(i->op, "leal") || !strcmp(i->op, "leaq"));
+}
+
+int is_reg(const char *arg)
+{
+	return arg[0] == '%';
+}
+
+int is_mem(const char *arg)
+{
+	return arg[0] != '%' && arg[0] != '$';
+}
+
+/* bits beyond the allocatable registers */
+#define REG_ESP (1 << 14)
+#define REG_EBP (1 << 15)
+
+static const struct {
+	const char *name;
+	enum reg reg;
+} reg_names[] = {
+	{ "eax", REG_EAX }, { "rax", REG_EAX }, { "ax", REG_EAX }, { "al", REG_EAX },
+	{ "ebx", REG_EBX }, { "rbx", REG_EBX }, { "bx", REG_EBX }, { "bl", REG_EBX },
+	{ "ecx", REG_ECX }, { "rcx", REG_ECX }, { "cx", REG_ECX }, { "cl", REG_ECX },
+	{ "edx", REG_EDX }, { "rdx", REG_EDX }, { "dx", REG_EDX }, { "dl", REG_EDX },
+	{ "esi", REG_ESI }, { "rsi", REG_ESI }, { "si", REG_ESI }, { "sil", REG_ESI },
+	{ "edi", REG_EDI }, { "rdi", REG_EDI }, { "di", REG_EDI }, { "dil", REG_EDI },
+	{ "esp", REG_ESP }, { "rsp", REG_ESP }, { "ebp", REG_EBP }, { "rbp", REG_EBP },
+	{ "r8", REG_R8 }, { "r9", REG_R9 }, { "r10", REG_R10 }, { "r11", REG_R11 },
+	{ "r12", REG_R12 }, { "r13", REG_R13 }, { "r14", REG_R14 }, { "r15", REG_R15 }
+};
+
+/* every register named in an operand, including address registers */
+enum reg arg_regs(const char *arg)
+{
+	enum reg regs = 0;
+	char name[8];
+	int i, n;
+	while ((arg = strchr(arg, '%'))) {
+		for (++arg, n = 0; n < 7 && ((*arg >= 'a' && *arg <= 'z') || (*arg >= '0' && *arg <= '9')); ++n) {
+			name[n] = *arg++;
+		}
+		name[n] = '\0';
+		/* %r8d, %r8w and %r8b all name r8 */
+		if (name[0] == 'r' && name[1] >= '0' && name[1] <= '9' && n > 2 &&
+		    (name[n - 1] == 'd' || name[n - 1] == 'w' || name[n - 1] == 'b')) {
+			name[n - 1] = '\0';
+		}
+		for (i = 0; i < sizeof(reg_names) / sizeof(reg_names[0]); ++i) {
+			if (!strcmp(name, reg_names[i].name)) {
+				regs |= reg_names[i].reg;
+			}
+		}
+	}
+	return regs;
+}
+
+static int op_is(struct insn *i, const char *prefix)
+{
+	return !strncmp(i->op, prefix, strlen(prefix));
+}
+
+/* registers an instruction reads and writes in full; returns 0 for
+   anything it does not understand, which then counts as reading all */
+static int insn_regs(struct insn *i, enum reg *use, enum reg *def)
+{
+	int n = i->num_args, j;
+	const char *dst = n ? i->args[n - 1] : "";
+	struct symbol *callee;
+	*use = *def = 0;
+	for (j = 0; j < n - 1; ++j) {
+		*use |= arg_regs(i->args[j]);
+	}
+	if (op_is(i, "imul") && n == 3) {
+		*def = arg_regs(dst);
+	} else if (op_is(i, "mov") || is_lea(i)) {
+		if (is_reg(dst)) {
+			*def = arg_regs(dst);
+		} else {
+			*use |= arg_regs(dst);
+		}
+	} else if (op_is(i, "xor") && n == 2 && !strcmp(i->args[0], dst)) {
+		*use = 0;
+		*def = arg_regs(dst);
+	} else if (op_is(i, "cmp") || op_is(i, "test")) {
+		*use |= arg_regs(dst);
+	} else if (op_is(i, "add") || op_is(i, "sub") || op_is(i, "imul") || op_is(i, "and") ||
+	           op_is(i, "or") || op_is(i, "xor") || op_is(i, "sh") || op_is(i, "sa") || op_is(i, "ro") ||
+	           op_is(i, "neg") || op_is(i, "not") || op_is(i, "inc") || op_is(i, "dec") ||
+	           op_is(i, "set") || op_is(i, "xchg")) {
+		*use |= arg_regs(dst);
+		if (is_reg(dst)) {
+			*def = arg_regs(dst);
+		}
+		if (op_is(i, "xchg")) {
+			*def |= arg_regs(i->args[0]);
+		}
+	} else if (!strcmp(i->op, "cltd") || !strcmp(i->op, "cqto")) {
+		*use = REG_EAX;
+		*def = REG_EDX;
+	} else if (op_is(i, "mul")) {
+		*use |= arg_regs(dst) | REG_EAX;
+		*def = REG_EAX | REG_EDX;
+	} else if (op_is(i, "idiv") || op_is(i, "div")) {
+		*use |= arg_regs(dst) | REG_EAX | REG_EDX;
+		*def = REG_EAX | REG_EDX;
+	} else if (op_is(i, "push")) {
+		*use |= arg_regs(dst) | REG_ESP;
+	} else if (op_is(i, "call")) {
+		for (j = 0; j < target->num_arg_regs; ++j) {
+			*use |= target->arg_regs[j];
+		}
+		*use |= REG_ESP;
+		/* a callee alloc summarized changes only what it said; anything else may change them all */
+		callee = n ? hash_table_lookup(callees, i->args[0]) : NULL;
+		*def = (callee ? callee->clobbers : target->caller_saved) | REG_EAX;
+	} else if (!strcmp(i->op, "leave")) {
+		*use = REG_EBP;
+		*def = REG_ESP | REG_EBP;
+	} else {
+		return 0;
+	}
+	return 1;
+}
+
+/* whether reg may be read on some path starting at i, following at
+   most a few jumps */
+static int reg_live_at(struct insn *i, enum reg reg, int jumps)
+{
+	enum reg use, def;
+	struct insn *t;
+	for (; i; i = i->next) {
+		if (i->kind == INSN_LABEL) {
+			continue;
+		}
+		if (i->kind == INSN_RAW || jumps == 0) {
+			return 1;
+		}
+		if (is_jump(i)) {
+			if (!(t = label_target(*list_head, i->args[0])) || reg_live_at(t, reg, jumps - 1)) {
+				return 1;
+			}
+			if (!is_cond_jump(i)) {
+				return 0;
+			}
+			continue;
+		}
+		if (!strcmp(i->op, "ret")) {
+			return (reg & (REG_EAX | target->callee_saved | REG_ESP | REG_EBP)) != 0;
+		}
+		if (!insn_regs(i, &use, &def) || (use & reg)) {
+			return 1;
+		}
+		if ((def & reg) == reg) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/* whether reg may be read after i runs */
+int reg_live(struct insn *i, enum reg reg)
+{
+	return reg_live_at(i->next, reg, 4);
+}
+
+/* the first instruction at label, or NULL if label is not defined here */
+struct insn *label_target(struct insn *list, const char *label)
+{
+	struct insn *i;
+	for (i = list; i; i = i->next) {
+		if (i->kind == INSN_LABEL && !strcmp(i->op, label)) {
+			while (i && i->kind == INSN_LABEL) {
+				i = i->next;
+			}
+			return i;
+		}
+	}
+	return NULL;
+}
+
+int remove_unreachable(struct insn **ip)
+{
+	int changed = 0, dead = 0;
+	while (*ip) {
+		struct insn *i = *ip;
+		if (i->kind == INSN_LABEL || i->kind == INSN_RAW) {
+			dead = 0;
+		} else if (dead) {
+			unlink_insn(ip);
+			changed = 1;
+			continue;
+		} else if (!strcmp(i->op, "jmp") || !strcmp(i->op, "ret")) {
+			dead = 1;
+		}
+		ip = &i->next;
+	}
+	return changed;
+}
+
+/* whether label is among the labels directly following i */
+static int falls_to(struct insn *i, const char *label)
+{
+	for (i = i->next; i && i->kind == INSN_LABEL; i = i->next) {
+		if (!strcmp(i->op, label)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static const char *const inverse[][2] = {
+	{ "je", "jne" }, { "jne", "je" }, { "jl", "jge" }, { "jge", "jl" },
+	{ "jle", "jg" }, { "jg", "jle" }, { "jz", "jnz" }, { "jnz", "jz" },
+	{ "jb", "jae" }, { "jae", "jb" }, { "jbe", "ja" }, { "ja", "jbe" },
+	{ "js", "jns" }, { "jns", "js" }
+};
+
+int remove_jumps(struct insn **ip)
+{
+	int changed = 0, k;
+	while (*ip) {
+		struct insn *i = *ip;
+		if (is_jump(i) && falls_to(i, i->args[0])) {
+			unlink_insn(ip);
+			changed = 1;
+			continue;
+		}
+		/* jcc a; jmp b; a: */
+		if (is_cond_jump(i) && i->next && i->next->kind == INSN_OP &&
+		    !strcmp(i->next->op, "jmp") && falls_to(i->next, i->args[0])) {
+			for (k = 0; k < sizeof(inverse) / sizeof(inverse[0]); ++k) {
+				if (!strcmp(i->op, inverse[k][0])) {
+					break;
+				}
+			}
+			if (k < sizeof(inverse) / sizeof(inverse[0])) {
+				free(i->op);
+				i->op = copy(inverse[k][1], strlen(inverse[k][1]));
+				free(i->args[0]);
+				i->args[0] = i->next->args[0];
+				i->next->args[0] = copy("", 0);
+				unlink_insn(&i->next);
+				changed = 1;
+				continue;
+			}
+		}
+		ip = &i->next;
+	}
+	return changed;
+}
+
+int thread_jumps(struct insn *list)
+{
+	struct insn *i, *t;
+	const char *label;
+	int changed = 0, hops;
+	for (i = list; i; i = i->next) {
+		if (!is_jump(i)) {
+			continue;
+		}
+		label = i->args[0];
+		for (hops = 0; hops < 16; ++hops) {
+			t = label_target(list, label);
+			if (!t || t->kind != INSN_OP || strcmp(t->op, "jmp")) {
+				break;
+			}
+			label = t->args[0];
+		}
+		/* a cycle of jumps stays as it is */
+		if (hops < 16 && label != i->args[0] && strcmp(label, i->args[0])) {
+			char *s = copy(label, strlen(label));
+			free(i->args[0]);
+			i->args[0] = s;
+			changed = 1;
+		}
+	}
+	return changed;
+}
+
+int remove_moves(struct insn **ip)
+{
+	int changed = 0;
+	while (*ip) {
+		struct insn *i = *ip, *n = i->next;
+		if (is_move(i) && !strcmp(i->args[0], i->args[1])) {
+			unlink_insn(ip);
+			changed = 1;
+			continue;
+		}
+		/* a move into a register nothing reads */
+		if ((is_move(i) || is_lea(i)) && is_reg(i->args[1]) &&
+		    !(arg_regs(i->args[1]) & (REG_ESP | REG_EBP)) && !reg_live(i, arg_regs(i->args[1]))) {
+			unlink_insn(ip);
+			changed = 1;
+			continue;
+		}
+		if (is_move(i) && n && is_move(n) && !strcmp(i->op, n->op)) {
+			/* store then reload, or load then store back */
+			if (!strcmp(i->args[0], n->args[1]) && !strcmp(i->args[1], n->args[0]) &&
+			    !(is_reg(i->args[1]) && (arg_regs(i->args[0]) & arg_regs(i->args[1])))) {
+				unlink_insn(&i->next);
+				changed = 1;
+				continue;
+			}
+			/* a reload of what was just stored comes from the register */
+			if (is_reg(i->args[0]) && !is_reg(i->args[1]) && !strcmp(i->args[1], n->args[0]) &&
+			    !(arg_regs(i->args[1]) & arg_regs(i->args[0]))) {
+				free(n->args[0]);
+				n->args[0] = copy(i->args[0], strlen(i->args[0]));
+				changed = 1;
+			}
+			/* mov a, r; mov r, b with r dead afterwards */
+			if (is_reg(i->args[1]) && !strcmp(i->args[1], n->args[0]) &&
+			    !(is_mem(i->args[0]) && is_mem(n->args[1])) &&
+			    !(is_mem(n->args[1]) && (arg_regs(n->args[1]) & arg_regs(i->args[1]))) &&
+			    !reg_live(n, arg_regs(i->args[1]))) {
+				free(i->args[1]);
+				i->args[1] = n->args[1];
+				n->args[1] = copy("", 0);
+				unlink_insn(&i->next);
+				changed = 1;
+				continue;
+			}
+		}
+		ip = &i->next;
+	}
+	return changed;
+}
+
+int remove_labels(struct insn **ip)
+{
+	struct insn *list = *ip, *i;
+	int changed = 0, entry = 1, used, j;
+	while (*ip) {
+		struct insn *l = *ip;
+		if (l->kind == INSN_OP) {
+			entry = 0;
+		}
+		if (l->kind != INSN_LABEL || entry || l->op[0] != '.') {
+			ip = &l->next;
+			continue;
+		}
+		used = 0;
+		for (i = list; i && !used; i = i->next) {
+			for (j = 0; i->kind == INSN_OP && j < i->num_args; ++j) {
+				used |= !strcmp(i->args[j], l->op);
+			}
+		}
+		if (used) {
+			ip = &l->next;
+		} else {
+			unlink_insn(ip);
+			changed = 1;
+		}
+	}
+	return changed;
+}
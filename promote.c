@@ -0,0 +1,340 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ast.h"
+#include "hash_table.h"
+
+static void promote_stmt(struct stmt **);
+static int uses_stmt(struct stmt *, int);
+static int uses_expr(struct expr *, int);
+static struct symbol *find_stmt(struct stmt *);
+static struct symbol *find_expr(struct expr *);
+static void rename_stmt(struct stmt *, struct symbol *);
+static void rename_expr(struct expr *, struct symbol *);
+
+/*
+a loop storing to a global goes to memory on every trip round. when nothing the loop calls can
+read or store the global, and the loop cannot return part way through, the global is loaded
+into a new local before the loop, the loop works on the local, and the local is stored back once
+the loop is done. inner loops are promoted first, so an outer loop can then promote the same
+global again around them.
+
+the new local is chained and counted here, every read of it linked to every store of it, the
+load included. that is more than annotate would link, which only keeps prune from dropping a
+store it could have.
+*/
+struct func {
+	struct decl *decl;
+	int stamp;
+};
+
+static struct prog *prog;
+static struct hash_table *funcs;
+static struct decl *current;
+static struct stmt *loop;
+static struct symbol *global;
+static int stamp;
+static struct chain *reads; /* those of the new local */
+static struct chain *stores;
+
+void ast_promote(struct prog *p, struct config *cfg)
+{
+	struct decl *d;
+	struct func *all;
+	int n = 0;
+	prog = p;
+	for (d = prog->ast; d; d = d->next) {
+		++n;
+	}
+	all = calloc(n + 1, sizeof(*all));
+	funcs = hash_table_create(0, 0);
+	for (n = 0, d = prog->ast; d; d = d->next) {
+		if (d->type->kind == TYPE_FUNCTION && d->code) {
+			all[n].decl = d;
+			hash_table_insert(funcs, d->name, &all[n++], NULL);
+		}
+	}
+	for (d = prog->ast; d; d = d->next) {
+		if (d->type->kind == TYPE_FUNCTION && d->code) {
+			current = d;
+			promote_stmt(&d->code);
+		}
+	}
+	hash_table_delete(funcs);
+	free(all);
+}
+
+/* whether a call to s may read or store the global, a function defined elsewhere being taken to */
+static int touches(struct symbol *s)
+{
+	struct func *f = hash_table_lookup(funcs, s->name);
+	if (!f) {
+		return 1;
+	}
+	if (f->stamp == stamp) {
+		return 0;
+	}
+	f->stamp = stamp;
+	return uses_stmt(f->decl->code, 1);
+}
+
+/* whether s may touch the global, through its own names when names is set or through its calls */
+int uses_stmt(struct stmt *s, int names)
+{
+	for (; s; s = s->next) {
+		if (s->decl && uses_expr(s->decl->value, names)) {
+			return 1;
+		}
+		if (uses_expr(s->expr, names) || uses_stmt(s->body, names) ||
+		    uses_stmt(s->ebody, names)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+int uses_expr(struct expr *e, int names)
+{
+	if (!e) {
+		return 0;
+	}
+	
+	switch (e->kind) {
+	case EXPR_NAME:
+	case EXPR_ASSIGN:
+		if (names && e->symbol == global) {
+			return 1;
+		}
+		break;
+	case EXPR_CALL:
+		if (touches(e->symbol)) {
+			return 1;
+		}
+		break;
+	default:
+		break;
+	}
+	return uses_expr(e->left, names) || uses_expr(e->right, names);
+}
+
+static int returns(struct stmt *s)
+{
+	for (; s; s = s->next) {
+		if (s->kind == STMT_RETURN || returns(s->body) || returns(s->ebody)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* whether the global g, stored to in the loop, can be kept in a local across it */
+static int promotable(struct symbol *g)
+{
+	if (!g || g->kind != SYMBOL_GLOBAL) {
+		return 0;
+	}
+	switch (g->type->kind) {
+	case TYPE_INT:
+	case TYPE_CHAR:
+	case TYPE_BOOLEAN:
+		break;
+	default:
+		return 0;
+	}
+	global = g;
+	++stamp;
+	return !uses_expr(loop->expr, 0) && !uses_stmt(loop->body, 0);
+}
+
+/* the first global stored to in the loop that can be promoted, or NULL */
+struct symbol *find_expr(struct expr *e)
+{
+	struct symbol *g = NULL;
+	if (!e) {
+		return NULL;
+	}
+	
+	switch (e->kind) {
+	case EXPR_ASSIGN:
+		g = e->symbol;
+		break;
+	case EXPR_PRE_INCR:
+	case EXPR_PRE_DECR:
+		g = e->right->symbol;
+		break;
+	case EXPR_POST_INCR:
+	case EXPR_POST_DECR:
+		g = e->left->symbol;
+		break;
+	default:
+		break;
+	}
+	if (promotable(g)) {
+		return g;
+	}
+	g = find_expr(e->left);
+	return g ? g : find_expr(e->right);
+}
+
+struct symbol *find_stmt(struct stmt *s)
+{
+	struct symbol *g = NULL;
+	for (; s && !g; s = s->next) {
+		if (s->decl) {
+			g = find_expr(s->decl->value);
+		}
+		if (!g) {
+			g = find_expr(s->expr);
+		}
+		if (!g) {
+			g = find_stmt(s->body);
+		}
+		if (!g) {
+			g = find_stmt(s->ebody);
+		}
+	}
+	return g;
+}
+
+void rename_stmt(struct stmt *s, struct symbol *to)
+{
+	for (; s; s = s->next) {
+		if (s->decl) {
+			rename_expr(s->decl->value, to);
+		}
+		rename_expr(s->expr, to);
+		rename_stmt(s->body, to);
+		rename_stmt(s->ebody, to);
+	}
+}
+
+static void add(struct chain **cp, struct expr *e)
+{
+	struct chain *c = malloc(sizeof(struct chain));
+	c->expr = e;
+	c->decl = NULL;
+	c->next = *cp;
+	*cp = c;
+}
+
+void rename_expr(struct expr *e, struct symbol *to)
+{
+	if (!e) {
+		return;
+	}
+	
+	rename_expr(e->left, to);
+	rename_expr(e->right, to);
+	switch (e->kind) {
+	case EXPR_NAME:
+		if (e->symbol == global) {
+			e->symbol = to;
+			add(&reads, e);
+		}
+		break;
+	case EXPR_ASSIGN:
+		if (e->symbol == global) {
+			e->symbol = to;
+			add(&stores, e);
+		}
+		break;
+	case EXPR_PRE_INCR:
+	case EXPR_PRE_DECR:
+		if (e->right->symbol == to) {
+			add(&stores, e);
+		}
+		break;
+	case EXPR_POST_INCR:
+	case EXPR_POST_DECR:
+		if (e->left->symbol == to) {
+			add(&stores, e);
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+/* links every read of the local d declares to every store of it */
+static void link_local(struct decl *d)
+{
+	struct chain *r, *w;
+	for (r = reads; r; r = r->next) {
+		chain_link(r->expr, NULL, d);
+		++d->symbol->num_reads;
+		for (w = stores; w; w = w->next) {
+			chain_link(r->expr, w->expr, NULL);
+		}
+	}
+	for (w = stores; w; w = w->next) {
+		++d->symbol->num_writes;
+	}
+	chain_free(&reads);
+	chain_free(&stores);
+}
+
+static char *name_copy(const char *name)
+{
+	char *copy = malloc(strlen(name) + 1);
+	strcpy(copy, name);
+	return copy;
+}
+
+static struct expr *name_of(struct symbol *s)
+{
+	struct expr *e = expr_make(EXPR_NAME, NULL, NULL, name_copy(s->name), 0);
+	e->symbol = s;
+	return e;
+}
+
+/*
+the loop at sp becomes { t = g; loop; g = t; } with the loop working on t. this hands back
+where the loop now sits.
+*/
+static struct stmt **promote(struct stmt **sp)
+{
+	struct stmt *s = *sp, *load, *block;
+	struct decl *d;
+	struct expr *store;
+	d = decl_make(name_copy(global->name), type_make(global->type->kind, NULL, NULL),
+	              name_of(global), NULL);
+	d->symbol = symbol_make(SYMBOL_LOCAL, d->type, d->name, prog);
+	d->symbol->offset = current->num_locals++;
+	rename_expr(s->expr, d->symbol);
+	rename_stmt(s->body, d->symbol);
+	
+	store = expr_make(EXPR_ASSIGN, NULL, name_of(d->symbol), name_copy(global->name), 0);
+	store->symbol = global;
+	add(&reads, store->right);
+	link_local(d);
+	++global->num_reads;
+	++global->num_writes;
+	load = stmt_make(STMT_DECL, d, NULL, NULL, NULL);
+	block = stmt_make(STMT_BLOCK, NULL, NULL, load, NULL);
+	block->next = s->next;
+	load->next = s;
+	s->next = stmt_make(STMT_EXPR, NULL, store, NULL, NULL);
+	*sp = block;
+	return &load->next;
+}
+
+void promote_stmt(struct stmt **sp)
+{
+	if (!sp || !(*sp)) {
+		return;
+	}
+	
+	struct stmt *s = *sp;
+	
+	promote_stmt(&s->next);
+	promote_stmt(&s->body);
+	promote_stmt(&s->ebody);
+	
+	if (s->kind != STMT_WHILE || returns(s->body)) {
+		return;
+	}
+	loop = s;
+	while (find_expr(s->expr) || find_stmt(s->body)) {
+		sp = promote(sp);
+	}
+}
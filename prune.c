@@ -1,12 +1,18 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "ast.h"
+#include "hash_table.h"
 
 static void prune_decl(struct decl **);
 static void prune_stmt(struct stmt **);
 static void prune_expr(struct expr **);
+static int unread(struct expr *);
+static void dead_globals(struct prog *, struct config *);
 
 void ast_prune(struct prog *prog, struct config *cfg)
 {
+	dead_globals(prog, cfg);
 	prune_decl(&prog->ast);
 }
 
@@ -43,6 +49,7 @@ void prune_stmt(struct stmt **sp)
 	}
 	
 	struct stmt *s = *sp;
+	struct stmt *effects;
 	
 	prune_stmt(&s->next);
 	
@@ -53,12 +60,27 @@ void prune_stmt(struct stmt **sp)
 	
 	switch (s->kind) {
 	case STMT_DECL:
-		/* excise unread decl? */
-		if (s->decl->symbol->num_reads == 0) {
-			
+		/* an initializer no read sees goes, keeping any side effects of its value */
+		if (s->decl->value && !s->decl->uses) {
+			if (expr_has_effects(s->decl->value)) {
+				effects = stmt_make(STMT_EXPR, NULL, s->decl->value, NULL, NULL);
+				effects->next = s->next;
+				s->next = effects;
+				s->decl->value = NULL;
+			} else {
+				expr_free(&s->decl->value);
+			}
+		}
+		if (s->decl->symbol->num_reads == 0 && !expr_has_effects(s->decl->value)) {
+			*sp = s->next;
+			s->next = NULL;
+			stmt_free(&s);
 		}
 		break;
 	case STMT_EXPR:
+		if (unread(s->expr)) {
+			expr_free(&s->expr);
+		}
 		if (!expr_has_effects(s->expr)) {
 			*sp = s->next;
 			s->next = NULL;
@@ -112,7 +134,7 @@ void prune_expr(struct expr **ep)
 	
 	switch (e->kind) {
 	case EXPR_ASSIGN:
-		if (e->symbol->num_reads == 0) {
+		if (e->symbol->num_reads == 0 || unread(e)) {
 			*ep = e->right;
 			e->right = NULL;
 			expr_free(&e);
@@ -122,3 +144,114 @@ void prune_expr(struct expr **ep)
 		break;
 	}
 }
+
+/*
+a store to a param or local is dead when its def-use chain is empty. this walk runs backwards,
+and dropping a store frees the reads in its value, which may leave earlier stores with none.
+*/
+int unread(struct expr *e)
+{
+	struct symbol *s;
+	switch (e->kind) {
+	case EXPR_ASSIGN:
+		s = e->symbol;
+		break;
+	case EXPR_PRE_INCR:
+	case EXPR_PRE_DECR:
+		s = e->right->symbol;
+		break;
+	case EXPR_POST_INCR:
+	case EXPR_POST_DECR:
+		s = e->left->symbol;
+		break;
+	default:
+		return 0;
+	}
+	return s->kind != SYMBOL_GLOBAL && !e->chain;
+}
+
+/*
+a global, function or not, is kept when main can reach it through the calls and names in the
+code it runs, and the rest go, declarations and all. a unit without main is a library, as is
+one built with -fkeep-exports, and every global it defines is taken to be used from outside.
+*/
+static struct hash_table *defined;
+static struct hash_table *reached;
+static struct decl **pending;
+static int num_pending;
+
+static void reach(struct symbol *s)
+{
+	struct decl *d;
+	if (s->kind != SYMBOL_GLOBAL || hash_table_lookup(reached, s->name)) {
+		return;
+	}
+	hash_table_insert(reached, s->name, s, NULL);
+	if ((d = hash_table_lookup(defined, s->name))) {
+		pending = realloc(pending, (num_pending + 1) * sizeof(struct decl *));
+		pending[num_pending++] = d;
+	}
+}
+
+static void reach_expr(struct expr *e)
+{
+	if (!e) {
+		return;
+	}
+	reach_expr(e->left);
+	reach_expr(e->right);
+	if (e->symbol) {
+		reach(e->symbol);
+	}
+}
+
+static void reach_stmt(struct stmt *s)
+{
+	if (!s) {
+		return;
+	}
+	if (s->decl) {
+		reach_expr(s->decl->value);
+	}
+	reach_expr(s->expr);
+	reach_stmt(s->body);
+	reach_stmt(s->ebody);
+	reach_stmt(s->next);
+}
+
+void dead_globals(struct prog *prog, struct config *cfg)
+{
+	struct decl *d, **dp;
+	if (!prog_closed(prog, cfg)) {
+		return;
+	}
+	defined = hash_table_create(0, 0);
+	reached = hash_table_create(0, 0);
+	for (d = prog->ast; d; d = d->next) {
+		if (d->code || d->value) {
+			hash_table_insert(defined, d->name, d, NULL);
+		}
+		if (d->code && !strcmp(d->name, "main")) {
+			reach(d->symbol);
+		}
+	}
+	while (num_pending > 0) {
+		d = pending[--num_pending];
+		reach_expr(d->value);
+		reach_stmt(d->code);
+	}
+	for (dp = &prog->ast; *dp; ) {
+		d = *dp;
+		if (hash_table_lookup(reached, d->name)) {
+			dp = &d->next;
+			continue;
+		}
+		*dp = d->next;
+		d->next = NULL;
+		decl_free(&d);
+	}
+	free(pending);
+	pending = NULL;
+	hash_table_delete(defined);
+	hash_table_delete(reached);
+}
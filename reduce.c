@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include "ast.h"
 
 static void reduce_decl(struct decl *);
@@ -7,7 +8,9 @@ static void reduce_expr(struct expr **);
 
 void ast_reduce(struct prog *prog, struct config *cfg)
 {
+	eval_begin(prog);
 	reduce_decl(prog->ast);
+	eval_end();
 }
 
 void reduce_decl(struct decl *d)
@@ -44,6 +47,12 @@ void reduce_stmt(struct stmt *s)
 #define REDUCE_CMP(op) REDUCE(op, EXPR_INT, EXPR_BOOLEAN)
 #define REDUCE_ARITH(op) REDUCE(op, EXPR_INT, EXPR_INT)
 #define REDUCE_BOOLEAN(op) REDUCE(op, EXPR_BOOLEAN, EXPR_BOOLEAN)
+/* the backends divide with the dividend zero-extended, which only agrees
+   with C for a dividend that is not negative */
+#define REDUCE_DIV(op) do { \
+	if (e->left->kind == EXPR_INT && e->left->constant >= 0 && \
+	e->right->kind == EXPR_INT && e->right->constant > 0) REDUCE_ARITH(op); \
+	} while (0)
 
 #define REDUCE_SELF(k, v) do { \
 	if (e->left->kind == EXPR_NAME && \
@@ -74,6 +83,14 @@ void reduce_stmt(struct stmt *s)
 	return; } } while (0)
 #define REDUCE_ARITH_SHORT(a, b, v) REDUCE_SHORT(a, b, EXPR_INT, v)
 #define REDUCE_BOOLEAN_SHORT(a, b, v) REDUCE_SHORT(a, b, EXPR_BOOLEAN, v)
+/* && and || never evaluate the right side once the left decides */
+#define REDUCE_BOOLEAN_SKIP(v) do { \
+	if (e->left->kind == EXPR_BOOLEAN && e->left->constant == v) { \
+	e->kind = EXPR_BOOLEAN; \
+	e->constant = v; \
+	expr_free(&e->left); \
+	expr_free(&e->right); \
+	return; } } while (0)
 
 #define REDUCE_ID(a, b, k, v) do { \
 	if (a->kind == k && a->constant == v) { \
@@ -97,6 +114,7 @@ void reduce_expr(struct expr **ep)
 	}
 	
 	struct expr *e = *ep;
+	int value;
 	
 	reduce_expr(&e->left);
 	reduce_expr(&e->right);
@@ -144,13 +162,13 @@ void reduce_expr(struct expr **ep)
 		REDUCE_ARITH_ID(e->right, e->left, 1);
 		break;
 	case EXPR_DIV:
-		REDUCE_ARITH(/);
+		REDUCE_DIV(/);
 		REDUCE_ARITH_SELF(1);
 		REDUCE_ARITH_SHORT(e->left, e->right, 0);
 		REDUCE_ARITH_ID(e->right, e->left, 1);
 		break;
 	case EXPR_MOD:
-		REDUCE_ARITH(%);
+		REDUCE_DIV(%);
 		REDUCE_ARITH_SELF(0);
 		REDUCE_ARITH_SHORT(e->left, e->right, 0);
 		if (e->right->kind == EXPR_INT && e->right->constant == 1 &&
@@ -164,7 +182,7 @@ void reduce_expr(struct expr **ep)
 		break;
 	case EXPR_AND:
 		REDUCE_BOOLEAN(&&);
-		REDUCE_BOOLEAN_SHORT(e->left, e->right, 0);
+		REDUCE_BOOLEAN_SKIP(0);
 		REDUCE_BOOLEAN_SHORT(e->right, e->left, 0);
 		REDUCE_BOOLEAN_ID(e->left, e->right, 1);
 		REDUCE_BOOLEAN_ID(e->right, e->left, 1);
@@ -172,7 +190,7 @@ void reduce_expr(struct expr **ep)
 		break;
 	case EXPR_OR:
 		REDUCE_BOOLEAN(||);
-		REDUCE_BOOLEAN_SHORT(e->left, e->right, 1);
+		REDUCE_BOOLEAN_SKIP(1);
 		REDUCE_BOOLEAN_SHORT(e->right, e->left, 1);
 		REDUCE_BOOLEAN_ID(e->left, e->right, 0);
 		REDUCE_BOOLEAN_ID(e->right, e->left, 0);
@@ -199,15 +217,32 @@ void reduce_expr(struct expr **ep)
 		if (e->left->kind != EXPR_INT || e->right->kind != EXPR_INT) {
 			break;
 		}
-		e->constant = 1;
-		while (e->right->constant > 0) {
-			e->constant *= e->left->constant;
-			e->right->constant -= 1;
-		}
+		e->constant = power(e->left->constant, e->right->constant);
 		e->kind = EXPR_INT;
 		expr_free(&e->left);
 		expr_free(&e->right);
 		break;
+	case EXPR_CALL:
+		if (!eval_call(e, &value)) {
+			break;
+		}
+		switch (e->symbol->type->rtype->kind) {
+		case TYPE_BOOLEAN:
+			e->kind = EXPR_BOOLEAN;
+			break;
+		case TYPE_CHAR:
+			e->kind = EXPR_CHAR;
+			break;
+		default:
+			e->kind = EXPR_INT;
+			break;
+		}
+		e->constant = value;
+		e->symbol = NULL;
+		free(e->name);
+		e->name = NULL;
+		expr_free(&e->right);
+		break;
 	case EXPR_ASSIGN:
 		if (e->right->kind == EXPR_NAME && e->symbol == e->right->symbol) {
 			*ep = expr_copy(e->right);
@@ -20,6 +20,15 @@ void ast_resolve(struct prog *p, struct config *cfg)
 	ferr = cfg->ferr;
 	should_print = cfg->flags & FLAG_PRINT_RESOLVE;
 	resolve_decl(p->ast);
+	/* in a whole program only main is called from outside */
+	if (prog_closed(p, cfg)) {
+		struct decl *d;
+		for (d = p->ast; d; d = d->next) {
+			if (d->code && strcmp(d->name, "main")) {
+				d->symbol->internal = 1;
+			}
+		}
+	}
 }
 
 static void resolve_print(struct symbol *s)
@@ -22,10 +22,13 @@ extern void print_char(char c)
 
 extern int power(int x, int y)
 {
-	int result = 1;
+	unsigned result = 1, base = x;
 	while (y > 0) {
-		result *= x;
-		--y;
+		if (y & 1) {
+			result *= base;
+		}
+		base *= base;
+		y >>= 1;
 	}
 	return result;
 }
@@ -0,0 +1,288 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "ast.h"
+
+static void select_decl(struct decl *);
+static void select_stmt(struct stmt *);
+static void select_expr(struct expr *, int goals);
+
+static FILE *ferr;
+
+void ast_select(struct prog *prog, struct config *cfg)
+{
+	ferr = cfg->ferr;
+	select_decl(prog->ast);
+}
+
+/*
+bottom-up rewriting: label() finds, for every nonterminal, the cheapest rule deriving it from a
+subtree, costed in instructions, and reduce() walks back down from what the statement needs,
+leaving the chosen rule in each node. Constants and variables reduced to NT_IMM and NT_MEM are
+folded into the instruction that uses them and never get a register.
+*/
+#define GOAL(nt) (1 << (nt))
+
+static int right_one(struct expr *e)
+{
+	return e->right->kind == EXPR_INT && e->right->constant == 1;
+}
+
+static int right_scale(struct expr *e)
+{
+	return e->right->kind == EXPR_INT &&
+	       (e->right->constant == 2 || e->right->constant == 4 || e->right->constant == 8);
+}
+
+static int right_divisor(struct expr *e)
+{
+	return e->right->kind == EXPR_INT && e->right->constant >= 2;
+}
+
+static int right_zero(struct expr *e)
+{
+	return e->right->kind == EXPR_INT && e->right->constant == 0;
+}
+
+static int pow_inline(struct expr *e)
+{
+	return !pow_calls(e);
+}
+
+/* strings are compared as pointers, which are wider than a cmpl on x86-64 */
+static int narrow(struct expr *e)
+{
+	return expr_to_type_kind(e->left) != TYPE_STRING;
+}
+
+/* x = x + y, where nothing in y can change x before it is read */
+static int update(struct expr *e)
+{
+	return e->right->left && e->right->left->kind == EXPR_NAME &&
+	       e->right->left->symbol == e->symbol && !expr_has_effects(e->right->right);
+}
+
+static const struct rule rules[] = {
+	{ EXPR_INT, NT_IMM, NT_NONE, NT_NONE, 0, NULL, NULL },
+	{ EXPR_CHAR, NT_IMM, NT_NONE, NT_NONE, 0, NULL, NULL },
+	{ EXPR_BOOLEAN, NT_IMM, NT_NONE, NT_NONE, 0, NULL, NULL },
+	{ EXPR_NAME, NT_MEM, NT_NONE, NT_NONE, 0, NULL, NULL },
+
+	{ EXPR_ADD, NT_REG, NT_REG, NT_IMM, 1, right_one, "incl\t%d" },
+	{ EXPR_SUB, NT_REG, NT_REG, NT_IMM, 1, right_one, "decl\t%d" },
+	{ EXPR_ADD, NT_REG, NT_REG, NT_INDEX, 1, NULL, "leal\t(%L,%X,%S), %d" },
+	{ EXPR_ADD, NT_REG, NT_INDEX, NT_REG, 1, NULL, "leal\t(%R,%X,%S), %d" },
+	{ EXPR_ADD, NT_REG, NT_INDEX, NT_IMM, 1, NULL, "leal\t%c(,%X,%S), %d" },
+	{ EXPR_ADD, NT_REG, NT_REG, NT_IMM, 1, NULL, "addl\t%r, %d" },
+	{ EXPR_ADD, NT_REG, NT_REG, NT_MEM, 1, NULL, "addl\t%r, %d" },
+	{ EXPR_SUB, NT_REG, NT_REG, NT_IMM, 1, NULL, "subl\t%r, %d" },
+	{ EXPR_SUB, NT_REG, NT_REG, NT_MEM, 1, NULL, "subl\t%r, %d" },
+	{ EXPR_MUL, NT_INDEX, NT_REG, NT_IMM, 0, right_scale, NULL },
+	{ EXPR_MUL, NT_REG, NT_REG, NT_IMM, 1, NULL, NULL },
+	{ EXPR_MUL, NT_REG, NT_REG, NT_MEM, 1, NULL, "imull\t%r, %d" },
+	{ EXPR_DIV, NT_REG, NT_REG, NT_IMM, 1, right_divisor, NULL },
+	{ EXPR_MOD, NT_REG, NT_REG, NT_IMM, 1, right_divisor, NULL },
+	{ EXPR_MOD, NT_MODULO, NT_REG, NT_IMM, 0, right_divisor, NULL },
+	{ EXPR_POW, NT_REG, NT_REG, NT_IMM, 1, pow_inline, NULL },
+
+	{ EXPR_EQ, NT_REG, NT_MODULO, NT_IMM, 1, right_zero, NULL },
+	{ EXPR_NE, NT_REG, NT_MODULO, NT_IMM, 1, right_zero, NULL },
+	{ EXPR_EQ, NT_REG, NT_REG, NT_IMM, 1, narrow, NULL },
+	{ EXPR_EQ, NT_REG, NT_REG, NT_MEM, 1, narrow, NULL },
+	{ EXPR_NE, NT_REG, NT_REG, NT_IMM, 1, narrow, NULL },
+	{ EXPR_NE, NT_REG, NT_REG, NT_MEM, 1, narrow, NULL },
+	{ EXPR_LT, NT_REG, NT_REG, NT_IMM, 1, NULL, NULL },
+	{ EXPR_LT, NT_REG, NT_REG, NT_MEM, 1, NULL, NULL },
+	{ EXPR_LE, NT_REG, NT_REG, NT_IMM, 1, NULL, NULL },
+	{ EXPR_LE, NT_REG, NT_REG, NT_MEM, 1, NULL, NULL },
+	{ EXPR_GT, NT_REG, NT_REG, NT_IMM, 1, NULL, NULL },
+	{ EXPR_GT, NT_REG, NT_REG, NT_MEM, 1, NULL, NULL },
+	{ EXPR_GE, NT_REG, NT_REG, NT_IMM, 1, NULL, NULL },
+	{ EXPR_GE, NT_REG, NT_REG, NT_MEM, 1, NULL, NULL },
+
+	{ EXPR_ASSIGN, NT_VOID, NT_NONE, NT_IMM, 1, NULL, "movl\t%r, %m" },
+	{ EXPR_ASSIGN, NT_VOID, NT_NONE, NT_UPDATE, 0, update, "" },
+	{ EXPR_ADD, NT_UPDATE, NT_MEM, NT_IMM, 1, right_one, "incl\t%l" },
+	{ EXPR_SUB, NT_UPDATE, NT_MEM, NT_IMM, 1, right_one, "decl\t%l" },
+	{ EXPR_ADD, NT_UPDATE, NT_MEM, NT_IMM, 1, NULL, "addl\t%r, %l" },
+	{ EXPR_ADD, NT_UPDATE, NT_MEM, NT_REG, 1, NULL, "addl\t%r, %l" },
+	{ EXPR_SUB, NT_UPDATE, NT_MEM, NT_IMM, 1, NULL, "subl\t%r, %l" },
+	{ EXPR_SUB, NT_UPDATE, NT_MEM, NT_REG, 1, NULL, "subl\t%r, %l" },
+
+	{ EXPR_ARG, NT_PRINT, NT_IMM, NT_PRINT, 0, NULL, NULL },
+	{ EXPR_ARG, NT_PRINT, NT_REG, NT_PRINT, 0, NULL, NULL }
+};
+
+#define NUM_RULES ((int)(sizeof(rules) / sizeof(rules[0])))
+
+/* any node, with its children in registers, in the backend's own way */
+static const struct rule fallback = { 0, NT_REG, NT_REG, NT_REG, 1, NULL, NULL };
+
+#define UNREACHABLE 0x3fffffff
+
+struct label {
+	int cost[NUM_NONTERMS];
+	const struct rule *rule[NUM_NONTERMS];
+};
+
+static void label(struct expr *e, struct label *l)
+{
+	struct label left, right;
+	const struct rule *r;
+	int i, nt, cost;
+	for (nt = 0; nt < NUM_NONTERMS; ++nt) {
+		l->cost[nt] = e ? UNREACHABLE : 0;
+		l->rule[nt] = NULL;
+	}
+	if (!e) {
+		return;
+	}
+	
+	label(e->left, &left);
+	label(e->right, &right);
+	for (i = 0; i <= NUM_RULES; ++i) {
+		r = i < NUM_RULES ? &rules[i] : &fallback;
+		if ((r != &fallback && r->kind != e->kind) || (r->when && !r->when(e)) ||
+		    left.cost[r->left] == UNREACHABLE || right.cost[r->right] == UNREACHABLE) {
+			continue;
+		}
+		cost = r->cost + left.cost[r->left] + right.cost[r->right];
+		if (cost < l->cost[r->result]) {
+			l->cost[r->result] = cost;
+			l->rule[r->result] = r;
+		}
+	}
+	/* any value can be computed and dropped */
+	if (l->cost[NT_REG] < l->cost[NT_VOID]) {
+		l->cost[NT_VOID] = l->cost[NT_REG];
+		l->rule[NT_VOID] = l->rule[NT_REG];
+	}
+}
+
+/* labels are recomputed on the way down rather than kept in every node;
+   statements are small enough for that not to matter */
+static void reduce(struct expr *e, enum nonterm goal)
+{
+	struct label l;
+	if (!e) {
+		return;
+	}
+	
+	label(e, &l);
+	if (!l.rule[goal]) {
+		fprintf(ferr, "select: no rule for expression kind %d\n", e->kind);
+		exit(1);
+	}
+	e->rule = l.rule[goal];
+	reduce(e->left, e->rule->left);
+	reduce(e->right, e->rule->right);
+}
+
+static int is_constant(struct expr *e)
+{
+	return e && (e->kind == EXPR_INT || e->kind == EXPR_CHAR || e->kind == EXPR_BOOLEAN);
+}
+
+/* constants go on the right, where instructions take immediates */
+static void swap_operands(struct expr *e)
+{
+	if (!e) {
+		return;
+	}
+	
+	swap_operands(e->left);
+	swap_operands(e->right);
+	if (!is_constant(e->left) || is_constant(e->right)) {
+		return;
+	}
+	switch (e->kind) {
+	case EXPR_ADD:
+	case EXPR_MUL:
+	case EXPR_EQ:
+	case EXPR_NE:
+		break;
+	case EXPR_LT:
+		e->kind = EXPR_GT;
+		break;
+	case EXPR_LE:
+		e->kind = EXPR_GE;
+		break;
+	case EXPR_GT:
+		e->kind = EXPR_LT;
+		break;
+	case EXPR_GE:
+		e->kind = EXPR_LE;
+		break;
+	default:
+		return;
+	}
+	struct expr *left = e->left;
+	e->left = e->right;
+	e->right = left;
+}
+
+void select_decl(struct decl *d)
+{
+	if (!d) {
+		return;
+	}
+	
+	switch (d->symbol->kind) {
+	case SYMBOL_GLOBAL:
+		if (d->type->kind == TYPE_FUNCTION) {
+			select_stmt(d->code);
+		}
+		break;
+	case SYMBOL_PARAM:
+		break;
+	case SYMBOL_LOCAL:
+		select_expr(d->value, GOAL(NT_REG) | GOAL(NT_IMM));
+		break;
+	}
+	
+	select_decl(d->next);
+}
+
+void select_stmt(struct stmt *s)
+{
+	if (!s) {
+		return;
+	}
+	
+	select_decl(s->decl);
+	switch (s->kind) {
+	case STMT_EXPR:
+		select_expr(s->expr, GOAL(NT_VOID));
+		break;
+	case STMT_PRINT:
+		select_expr(s->expr, GOAL(NT_PRINT));
+		break;
+	case STMT_RETURN:
+		select_expr(s->expr, GOAL(NT_REG) | GOAL(NT_IMM) | GOAL(NT_MEM));
+		break;
+	default:
+		select_expr(s->expr, GOAL(NT_REG));
+		break;
+	}
+	select_stmt(s->body);
+	select_stmt(s->ebody);
+	select_stmt(s->next);
+}
+
+/* reduces e to the cheapest of the nonterminals in goals */
+void select_expr(struct expr *e, int goals)
+{
+	if (!e) {
+		return;
+	}
+	
+	struct label l;
+	int nt, best = NT_NONE;
+	swap_operands(e);
+	label(e, &l);
+	for (nt = 0; nt < NUM_NONTERMS; ++nt) {
+		if ((goals & GOAL(nt)) && l.rule[nt] && (best == NT_NONE || l.cost[nt] < l.cost[best])) {
+			best = nt;
+		}
+	}
+	reduce(e, best);
+}
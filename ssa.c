@@ -0,0 +1,1358 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ir.h"
+#include "hash_table.h"
+
+static void ssa_func(struct ir_func *);
+static void sccp_func(struct ir_func *);
+static void gvn_func(struct ir_func *);
+static void unssa_func(struct ir_func *);
+
+void ir_ssa(struct prog *prog, struct config *cfg)
+{
+	struct ir_func *f;
+	if (cfg->opt_level == 0) {
+		return;
+	}
+	for (f = prog->ir; f; f = f->next) {
+		ssa_func(f);
+	}
+}
+
+void ir_sccp(struct prog *prog, struct config *cfg)
+{
+	struct ir_func *f;
+	if (cfg->opt_level == 0) {
+		return;
+	}
+	for (f = prog->ir; f; f = f->next) {
+		sccp_func(f);
+	}
+}
+
+void ir_gvn(struct prog *prog, struct config *cfg)
+{
+	struct ir_func *f;
+	if (cfg->opt_level == 0) {
+		return;
+	}
+	for (f = prog->ir; f; f = f->next) {
+		gvn_func(f);
+	}
+}
+
+void ir_unssa(struct prog *prog, struct config *cfg)
+{
+	struct ir_func *f;
+	if (cfg->opt_level == 0) {
+		return;
+	}
+	for (f = prog->ir; f; f = f->next) {
+		unssa_func(f);
+	}
+}
+
+static int pred_index(struct block *b, struct block *pred)
+{
+	int n;
+	for (n = 0; b->preds[n] != pred; ++n);
+	return n;
+}
+
+/* drops the edge from pred into b, along with the phi args it carried */
+static void remove_pred(struct block *b, struct block *pred)
+{
+	struct ir_insn *i;
+	int n = pred_index(b, pred);
+	memmove(b->preds + n, b->preds + n + 1, (b->num_preds - n - 1) * sizeof(struct block *));
+	for (i = b->first; i && i->op == IR_PHI; i = i->next) {
+		memmove(i->args + n, i->args + n + 1, (i->num_args - n - 1) * sizeof(struct operand));
+		--i->num_args;
+	}
+	--b->num_preds;
+}
+
+/*
+construction follows Cytron et al.: a variable gets phis on the iterated dominance frontier of
+the blocks assigning it, then a walk down the dominator tree gives every assignment a fresh temp
+and points each use at the one reaching it. locals and params are renamed, and so are the temps
+lowering assigns more than once, leaving only globals in memory; each param is copied out of its
+slot once, at the entry. only variables read in some block before being assigned there can need
+a phi (semi-pruned form), and a variable read before any assignment reads 0.
+*/
+static struct ir_func *func;
+static int num_temps;
+static int num_vars;
+static struct symbol **syms;
+static char *sym_read;
+static int num_syms;
+static enum type_kind *var_type;
+static struct operand *reaching;
+static struct block ***children;
+static int *num_children;
+static int **phi_vars;
+static int *num_phis;
+
+struct undo {
+	int var;
+	struct operand value;
+};
+
+static struct undo *undo;
+static int num_undo;
+static int max_undo;
+
+/* the variable an operand names, or -1 */
+static int var_of(struct operand o)
+{
+	int n;
+	if (o.kind == OPERAND_TEMP) {
+		return o.value < num_temps ? o.value : -1;
+	}
+	if (o.kind != OPERAND_VAR || o.symbol->kind == SYMBOL_GLOBAL) {
+		return -1;
+	}
+	for (n = 0; n < num_syms; ++n) {
+		if (syms[n] == o.symbol) {
+			return num_temps + n;
+		}
+	}
+	return -1;
+}
+
+static void add_var(struct operand o, int read)
+{
+	int n;
+	if (o.kind == OPERAND_TEMP) {
+		var_type[o.value] = o.type;
+	}
+	if (o.kind != OPERAND_VAR || o.symbol->kind == SYMBOL_GLOBAL) {
+		return;
+	}
+	for (n = 0; n < num_syms && syms[n] != o.symbol; ++n);
+	if (n == num_syms) {
+		syms = realloc(syms, (num_syms + 1) * sizeof(struct symbol *));
+		sym_read = realloc(sym_read, num_syms + 1);
+		syms[num_syms] = o.symbol;
+		sym_read[num_syms++] = 0;
+	}
+	sym_read[n] |= read;
+}
+
+static void collect_vars(struct ir_func *f)
+{
+	struct block *b;
+	struct ir_insn *i;
+	int n;
+	num_temps = f->num_temps;
+	var_type = malloc((num_temps + 1) * sizeof(enum type_kind));
+	syms = NULL;
+	sym_read = NULL;
+	num_syms = 0;
+	for (b = f->entry; b; b = b->next) {
+		for (i = b->first; i; i = i->next) {
+			add_var(i->dst, 0);
+			add_var(i->src[0], 1);
+			add_var(i->src[1], 1);
+			for (n = 0; n < i->num_args; ++n) {
+				add_var(i->args[n], 1);
+			}
+		}
+	}
+	num_vars = num_temps + num_syms;
+	var_type = realloc(var_type, (num_vars + 1) * sizeof(enum type_kind));
+	reaching = malloc((num_vars + 1) * sizeof(struct operand));
+	for (n = 0; n < num_temps; ++n) {
+		reaching[n] = operand_const(0, var_type[n]);
+	}
+	for (n = 0; n < num_syms; ++n) {
+		var_type[num_temps + n] = syms[n]->type->kind;
+		reaching[num_temps + n] = operand_const(0, syms[n]->type->kind);
+		if (syms[n]->kind == SYMBOL_PARAM) {
+			/* the copy at the entry reads the param's own slot */
+			reaching[num_temps + n].kind = OPERAND_VAR;
+			reaching[num_temps + n].symbol = syms[n];
+		}
+	}
+}
+
+static void copy_params(struct ir_func *f)
+{
+	struct operand v;
+	struct ir_insn *i;
+	int n;
+	for (n = 0; n < num_syms; ++n) {
+		if (syms[n]->kind != SYMBOL_PARAM || !sym_read[n]) {
+			continue;
+		}
+		v = reaching[num_temps + n];
+		i = ir_insn_make(IR_COPY, v, v, operand_none());
+		if (f->entry->first) {
+			ir_insert(f->entry->first, i);
+		} else {
+			ir_append(f->entry, i);
+		}
+	}
+}
+
+/* frontier[b]: the blocks b's dominance ends at, one step short of */
+static struct block ***frontier;
+static int *num_frontier;
+
+static void add_frontier(struct block *b, struct block *to)
+{
+	int n = num_frontier[b->id];
+	if (n && frontier[b->id][n - 1] == to) {
+		return;
+	}
+	frontier[b->id] = realloc(frontier[b->id], (n + 1) * sizeof(struct block *));
+	frontier[b->id][num_frontier[b->id]++] = to;
+}
+
+static void dominance(struct ir_func *f)
+{
+	struct block *b, *runner;
+	int n;
+	ir_dominators(f);
+	children = calloc(f->num_blocks, sizeof(struct block **));
+	num_children = calloc(f->num_blocks, sizeof(int));
+	frontier = calloc(f->num_blocks, sizeof(struct block **));
+	num_frontier = calloc(f->num_blocks, sizeof(int));
+	for (b = f->entry; b; b = b->next) {
+		if (b->idom) {
+			n = num_children[b->idom->id]++;
+			children[b->idom->id] = realloc(children[b->idom->id], (n + 1) * sizeof(struct block *));
+			children[b->idom->id][n] = b;
+		}
+		if (b->num_preds < 2) {
+			continue;
+		}
+		for (n = 0; n < b->num_preds; ++n) {
+			for (runner = b->preds[n]; runner != b->idom; runner = runner->idom) {
+				add_frontier(runner, b);
+			}
+		}
+	}
+}
+
+static void free_dominance(struct ir_func *f)
+{
+	int n;
+	for (n = 0; n < f->num_blocks; ++n) {
+		free(children[n]);
+		free(frontier[n]);
+	}
+	free(children);
+	free(num_children);
+	free(frontier);
+	free(num_frontier);
+}
+
+static struct block **block_list(struct ir_func *f)
+{
+	struct block **blocks = malloc(f->num_blocks * sizeof(struct block *)), *b;
+	for (b = f->entry; b; b = b->next) {
+		blocks[b->id] = b;
+	}
+	return blocks;
+}
+
+static void place_phis(struct ir_func *f)
+{
+	struct block *b, **blocks = block_list(f), **work, *y;
+	struct ir_insn *i, *phi;
+	char *assigns = calloc((size_t)num_vars * f->num_blocks, 1), *live = calloc(num_vars, 1);
+	int *seen = calloc(num_vars, sizeof(int)), *has_phi, *queued;
+	int v, n, k, top;
+	
+	/* where each variable is assigned, and which are read before being assigned in a block */
+	for (b = f->entry; b; b = b->next) {
+		for (i = b->first; i; i = i->next) {
+			for (n = 0; n < 2 + i->num_args; ++n) {
+				v = var_of(n < 2 ? i->src[n] : i->args[n - 2]);
+				if (v >= 0 && seen[v] != b->id + 1) {
+					live[v] = 1;
+				}
+			}
+			if ((v = var_of(i->dst)) >= 0) {
+				seen[v] = b->id + 1;
+				assigns[(size_t)v * f->num_blocks + b->id] = 1;
+			}
+		}
+	}
+	
+	phi_vars = calloc(f->num_blocks, sizeof(int *));
+	num_phis = calloc(f->num_blocks, sizeof(int));
+	work = malloc(f->num_blocks * sizeof(struct block *));
+	has_phi = calloc(f->num_blocks, sizeof(int));
+	queued = calloc(f->num_blocks, sizeof(int));
+	for (v = 0; v < num_vars; ++v) {
+		if (!live[v]) {
+			continue;
+		}
+		top = 0;
+		for (n = 0; n < f->num_blocks; ++n) {
+			if (assigns[(size_t)v * f->num_blocks + n]) {
+				work[top++] = blocks[n];
+				queued[n] = v + 1;
+			}
+		}
+		while (top > 0) {
+			b = work[--top];
+			for (n = 0; n < num_frontier[b->id]; ++n) {
+				y = frontier[b->id][n];
+				if (has_phi[y->id] == v + 1) {
+					continue;
+				}
+				has_phi[y->id] = v + 1;
+				phi = ir_insn_make(IR_PHI, operand_none(), operand_none(), operand_none());
+				phi->dst.kind = OPERAND_TEMP;
+				phi->dst.type = var_type[v];
+				phi->args = malloc(y->num_preds * sizeof(struct operand));
+				phi->num_args = y->num_preds;
+				for (k = 0; k < y->num_preds; ++k) {
+					phi->args[k] = operand_none();
+				}
+				/* phis stay in the order of phi_vars, ahead of everything else */
+				k = num_phis[y->id]++;
+				phi_vars[y->id] = realloc(phi_vars[y->id], (k + 1) * sizeof(int));
+				phi_vars[y->id][k] = v;
+				for (i = y->first; i && k > 0; i = i->next, --k);
+				if (i) {
+					ir_insert(i, phi);
+				} else {
+					ir_append(y, phi);
+				}
+				if (queued[y->id] != v + 1) {
+					queued[y->id] = v + 1;
+					work[top++] = y;
+				}
+			}
+		}
+	}
+	free(blocks);
+	free(assigns);
+	free(live);
+	free(seen);
+	free(work);
+	free(has_phi);
+	free(queued);
+}
+
+static void use(struct operand *o)
+{
+	int v = var_of(*o);
+	if (v >= 0) {
+		*o = reaching[v];
+	}
+}
+
+static void define(int v, struct ir_insn *i)
+{
+	if (num_undo == max_undo) {
+		max_undo = max_undo ? max_undo * 2 : 64;
+		undo = realloc(undo, max_undo * sizeof(struct undo));
+	}
+	undo[num_undo].var = v;
+	undo[num_undo++].value = reaching[v];
+	i->dst = operand_temp(func, var_type[v]);
+	reaching[v] = i->dst;
+}
+
+static void rename_block(struct block *b)
+{
+	struct ir_insn *i;
+	struct block *s;
+	int n, k, mark = num_undo, v;
+	for (i = b->first, k = 0; k < num_phis[b->id]; i = i->next, ++k) {
+		define(phi_vars[b->id][k], i);
+	}
+	for (; i; i = i->next) {
+		use(&i->src[0]);
+		use(&i->src[1]);
+		for (n = 0; n < i->num_args; ++n) {
+			use(&i->args[n]);
+		}
+		if ((v = var_of(i->dst)) >= 0) {
+			define(v, i);
+		}
+	}
+	for (n = 0; n < block_num_succs(b); ++n) {
+		s = b->succ[n];
+		for (i = s->first, k = 0; k < num_phis[s->id]; i = i->next, ++k) {
+			i->args[pred_index(s, b)] = reaching[phi_vars[s->id][k]];
+		}
+	}
+	for (n = 0; n < num_children[b->id]; ++n) {
+		rename_block(children[b->id][n]);
+	}
+	while (num_undo > mark) {
+		--num_undo;
+		reaching[undo[num_undo].var] = undo[num_undo].value;
+	}
+}
+
+void ssa_func(struct ir_func *f)
+{
+	int n;
+	func = f;
+	collect_vars(f);
+	copy_params(f);
+	dominance(f);
+	place_phis(f);
+	rename_block(f->entry);
+	for (n = 0; n < f->num_blocks; ++n) {
+		free(phi_vars[n]);
+	}
+	free_dominance(f);
+	free(phi_vars);
+	free(num_phis);
+	free(syms);
+	free(sym_read);
+	free(var_type);
+	free(reaching);
+	free(undo);
+	undo = NULL;
+	num_undo = max_undo = 0;
+	ir_renumber(f);
+}
+
+/*
+Wegman and Zadeck's sparse conditional constant propagation. a temp is unknown until shown to
+be constant and varying once it may take two values; only blocks reached along edges found
+executable are evaluated, so a branch on a constant never enables its other arm, and a phi
+ignores what arrives along edges that are not. constants then replace the temps, decided
+branches become jumps, blocks never reached are deleted, and phis left choosing between one
+value are forwarded to it.
+*/
+enum lattice {
+	UNKNOWN,
+	CONSTANT,
+	VARYING
+};
+
+static enum lattice *state;
+static struct operand *value;
+static char *executable;
+static char *edges; /* [block * 2 + succ] */
+static struct ir_insn ***users;
+static int *num_users;
+static struct ir_insn **work;
+static int num_work;
+static int max_work;
+static struct block **flow;
+static int num_flow;
+
+static void push(struct ir_insn *i)
+{
+	if (num_work == max_work) {
+		max_work = max_work ? max_work * 2 : 64;
+		work = realloc(work, max_work * sizeof(struct ir_insn *));
+	}
+	work[num_work++] = i;
+}
+
+static void add_user(struct operand o, struct ir_insn *i)
+{
+	int n;
+	if (o.kind != OPERAND_TEMP) {
+		return;
+	}
+	n = num_users[o.value]++;
+	users[o.value] = realloc(users[o.value], (n + 1) * sizeof(struct ir_insn *));
+	users[o.value][n] = i;
+}
+
+static void update(struct operand d, enum lattice s, struct operand v)
+{
+	int t = d.value, n;
+	if (d.kind != OPERAND_TEMP || s == UNKNOWN || state[t] == VARYING ||
+	    (state[t] == CONSTANT && s == CONSTANT && operand_eq(value[t], v))) {
+		return;
+	}
+	state[t] = state[t] == CONSTANT ? VARYING : s;
+	value[t] = v;
+	for (n = 0; n < num_users[t]; ++n) {
+		push(users[t][n]);
+	}
+}
+
+static enum lattice lookup(struct operand o, struct operand *v)
+{
+	switch (o.kind) {
+	case OPERAND_CONST:
+	case OPERAND_STRING:
+		*v = o;
+		return CONSTANT;
+	case OPERAND_TEMP:
+		*v = value[o.value];
+		return state[o.value];
+	default:
+		return VARYING;
+	}
+}
+
+/* a op b over the lattice; strings are only ever compared for identity */
+static enum lattice evaluate(enum ir_op op, struct operand a, struct operand b, enum type_kind type, struct operand *v)
+{
+	struct operand x, y = operand_const(0, TYPE_INT);
+	enum lattice s = lookup(a, &x), t = b.kind == OPERAND_NONE ? CONSTANT : lookup(b, &y);
+	int result;
+	if (s == VARYING || t == VARYING) {
+		return VARYING;
+	}
+	if (s == UNKNOWN || t == UNKNOWN) {
+		return UNKNOWN;
+	}
+	if (op == IR_COPY) {
+		*v = x;
+		return CONSTANT;
+	}
+	if (x.kind == OPERAND_STRING || y.kind == OPERAND_STRING) {
+		if (x.kind != y.kind || (op != IR_EQ && op != IR_NE)) {
+			return VARYING;
+		}
+		result = (x.value == y.value) == (op == IR_EQ);
+	} else if (!ir_fold(op, x.value, y.value, &result)) {
+		return VARYING;
+	}
+	*v = operand_const(result, type);
+	return CONSTANT;
+}
+
+static int edge_executable(struct block *from, struct block *to)
+{
+	return executable[from->id] && (edges[from->id * 2] && from->succ[0] == to ? 1 :
+	                                 edges[from->id * 2 + 1] && from->succ[1] == to);
+}
+
+static void mark_edge(struct block *b, int n)
+{
+	struct block *to = b->succ[n];
+	struct ir_insn *i;
+	if (edges[b->id * 2 + n]) {
+		return;
+	}
+	edges[b->id * 2 + n] = 1;
+	if (!executable[to->id]) {
+		executable[to->id] = 1;
+		flow[num_flow++] = to;
+		return;
+	}
+	for (i = to->first; i && i->op == IR_PHI; i = i->next) {
+		push(i);
+	}
+}
+
+static void visit(struct ir_insn *i)
+{
+	struct block *b = i->block;
+	struct operand v = operand_none(), a;
+	enum lattice s;
+	int n;
+	switch (i->op) {
+	case IR_JUMP:
+		mark_edge(b, 0);
+		break;
+	case IR_BRANCH:
+		s = evaluate(i->cmp, i->src[0], i->src[1], TYPE_BOOLEAN, &v);
+		if (s == CONSTANT) {
+			mark_edge(b, v.value ? 0 : 1);
+		} else if (s == VARYING) {
+			mark_edge(b, 0);
+			mark_edge(b, 1);
+		}
+		break;
+	case IR_RETURN:
+	case IR_PRINT:
+		break;
+	case IR_CALL:
+		update(i->dst, VARYING, v);
+		break;
+	case IR_PHI:
+		s = UNKNOWN;
+		for (n = 0; n < i->num_args && s != VARYING; ++n) {
+			if (!edge_executable(b->preds[n], b)) {
+				continue;
+			}
+			switch (lookup(i->args[n], &a)) {
+			case UNKNOWN:
+				break;
+			case CONSTANT:
+				if (s == UNKNOWN) {
+					s = CONSTANT;
+					v = a;
+				} else if (!operand_eq(a, v)) {
+					s = VARYING;
+				}
+				break;
+			case VARYING:
+				s = VARYING;
+				break;
+			}
+		}
+		update(i->dst, s, v);
+		break;
+	default:
+		update(i->dst, evaluate(i->op, i->src[0], i->src[1], i->dst.type, &v), v);
+		break;
+	}
+}
+
+static void propagate(struct ir_func *f)
+{
+	struct block *b;
+	struct ir_insn *i;
+	int n;
+	flow = malloc(f->num_blocks * sizeof(struct block *));
+	num_flow = 0;
+	executable[f->entry->id] = 1;
+	flow[num_flow++] = f->entry;
+	while (num_flow > 0 || num_work > 0) {
+		while (num_work > 0) {
+			i = work[--num_work];
+			if (executable[i->block->id]) {
+				visit(i);
+			}
+		}
+		if (num_flow > 0) {
+			b = flow[--num_flow];
+			for (i = b->first; i; i = i->next) {
+				visit(i);
+			}
+		}
+	}
+	free(flow);
+	for (n = 0; n < f->num_temps; ++n) {
+		free(users[n]);
+	}
+}
+
+/* where each temp's uses should now point: itself, a constant or
+   another temp */
+static struct operand *forward;
+
+static struct operand forwarded(struct operand o)
+{
+	while (o.kind == OPERAND_TEMP && !operand_eq(forward[o.value], o)) {
+		o = forward[o.value];
+	}
+	return o;
+}
+
+/* a phi whose args are all one value, or itself, is that value */
+static int trivial_phi(struct ir_insn *i, struct operand *v)
+{
+	struct operand a;
+	int n, found = 0;
+	for (n = 0; n < i->num_args; ++n) {
+		a = forwarded(i->args[n]);
+		if (operand_eq(a, i->dst) || (found && operand_eq(a, *v))) {
+			continue;
+		}
+		if (found) {
+			return 0;
+		}
+		*v = a;
+		found = 1;
+	}
+	if (!found) {
+		*v = operand_const(0, i->dst.type);
+	}
+	return 1;
+}
+
+static void rewrite(struct ir_func *f)
+{
+	struct block *b, **bp, *dead;
+	struct ir_insn *i, *next;
+	struct operand v;
+	int n, changed = 1;
+	forward = malloc((f->num_temps + 1) * sizeof(struct operand));
+	for (n = 0; n < f->num_temps; ++n) {
+		if (state[n] == CONSTANT) {
+			forward[n] = value[n];
+		} else {
+			forward[n] = operand_none();
+			forward[n].kind = OPERAND_TEMP;
+			forward[n].value = n;
+		}
+	}
+	
+	/* decided branches become jumps, and unreached blocks go */
+	for (b = f->entry; b; b = b->next) {
+		if (!executable[b->id] || block_num_succs(b) < 2 || (edges[b->id * 2] && edges[b->id * 2 + 1])) {
+			continue;
+		}
+		if (!edges[b->id * 2] && !edges[b->id * 2 + 1]) {
+			continue;
+		}
+		n = edges[b->id * 2] ? 0 : 1;
+		remove_pred(b->succ[1 - n], b);
+		b->succ[0] = b->succ[n];
+		b->succ[1] = NULL;
+		b->last->op = IR_JUMP;
+		b->last->src[0] = b->last->src[1] = operand_none();
+	}
+	for (b = f->entry; b; b = b->next) {
+		if (executable[b->id]) {
+			continue;
+		}
+		for (n = 0; n < block_num_succs(b); ++n) {
+			if (executable[b->succ[n]->id]) {
+				remove_pred(b->succ[n], b);
+			}
+		}
+	}
+	for (bp = &f->entry; *bp; ) {
+		dead = *bp;
+		if (executable[dead->id]) {
+			bp = &dead->next;
+		} else {
+			*bp = dead->next;
+			block_free(&dead);
+		}
+	}
+	
+	while (changed) {
+		changed = 0;
+		for (b = f->entry; b; b = b->next) {
+			for (i = b->first; i && i->op == IR_PHI; i = i->next) {
+				if (operand_eq(forwarded(i->dst), i->dst) && trivial_phi(i, &v)) {
+					forward[i->dst.value] = v;
+					changed = 1;
+				}
+			}
+		}
+	}
+	
+	for (b = f->entry; b; b = b->next) {
+		for (i = b->first; i; i = next) {
+			next = i->next;
+			if (i->dst.kind == OPERAND_TEMP && i->op != IR_CALL &&
+			    !operand_eq(forwarded(i->dst), i->dst)) {
+				ir_remove(i);
+				continue;
+			}
+			i->src[0] = forwarded(i->src[0]);
+			i->src[1] = forwarded(i->src[1]);
+			for (n = 0; n < i->num_args; ++n) {
+				i->args[n] = forwarded(i->args[n]);
+			}
+		}
+	}
+	free(forward);
+	
+	f->num_blocks = 0;
+	for (b = f->entry; b; b = b->next) {
+		b->id = f->num_blocks++;
+	}
+}
+
+void sccp_func(struct ir_func *f)
+{
+	struct block *b;
+	struct ir_insn *i;
+	int n;
+	state = calloc(f->num_temps + 1, sizeof(enum lattice));
+	value = malloc((f->num_temps + 1) * sizeof(struct operand));
+	executable = calloc(f->num_blocks, 1);
+	edges = calloc(f->num_blocks * 2, 1);
+	users = calloc(f->num_temps + 1, sizeof(struct ir_insn **));
+	num_users = calloc(f->num_temps + 1, sizeof(int));
+	for (b = f->entry; b; b = b->next) {
+		for (i = b->first; i; i = i->next) {
+			add_user(i->src[0], i);
+			add_user(i->src[1], i);
+			for (n = 0; n < i->num_args; ++n) {
+				add_user(i->args[n], i);
+			}
+		}
+	}
+	propagate(f);
+	rewrite(f);
+	free(state);
+	free(value);
+	free(executable);
+	free(edges);
+	free(users);
+	free(num_users);
+	free(work);
+	work = NULL;
+	num_work = max_work = 0;
+	ir_renumber(f);
+}
+
+/*
+dominator-based value numbering after Briggs, Cooper and Simpson: going down the dominator tree,
+an insn computing what one above it has already computed from the same values is dropped and
+its uses take the earlier result, and so is a phi repeating another in its block or choosing
+between one value, and a copy. only globals can change under a temp, so first each block reads
+a global it uses more than once into a temp, until a call or a store, and a store whose value is
+read again in the block keeps it in a temp.
+*/
+struct avail {
+	struct symbol *symbol;
+	struct operand value;
+};
+
+static struct avail *avail;
+static int num_avail;
+static struct hash_table *values;
+static char **keys;
+static int num_keys;
+static int max_keys;
+static char *key;
+static size_t key_size;
+
+static int is_global(struct operand o, struct symbol *s)
+{
+	return o.kind == OPERAND_VAR && o.symbol->kind == SYMBOL_GLOBAL && (!s || o.symbol == s);
+}
+
+static int reads_global(struct ir_insn *i, struct symbol *s)
+{
+	int n, count = 0;
+	for (n = 0; n < 2 + i->num_args; ++n) {
+		count += is_global(n < 2 ? i->src[n] : i->args[n - 2], s);
+	}
+	return count;
+}
+
+/* whether s is read after i before anything can change it */
+static int read_again(struct ir_insn *i, struct symbol *s)
+{
+	for (i = i->next; i; i = i->next) {
+		if (reads_global(i, s)) {
+			return 1;
+		}
+		if (i->op == IR_CALL || is_global(i->dst, s)) {
+			return 0;
+		}
+	}
+	return 0;
+}
+
+static int find_avail(struct symbol *s)
+{
+	int n;
+	for (n = 0; n < num_avail && avail[n].symbol != s; ++n);
+	return n < num_avail ? n : -1;
+}
+
+static int add_avail(struct symbol *s, struct operand v)
+{
+	avail = realloc(avail, (num_avail + 1) * sizeof(struct avail));
+	avail[num_avail].symbol = s;
+	avail[num_avail].value = v;
+	return num_avail++;
+}
+
+static void local_globals(struct ir_func *f, struct block *b)
+{
+	struct ir_insn *i, *store;
+	struct operand *o, t;
+	struct symbol *s;
+	int n, k;
+	num_avail = 0;
+	for (i = b->first; i; i = i->next) {
+		for (n = 0; n < 2 + i->num_args; ++n) {
+			o = n < 2 ? &i->src[n] : &i->args[n - 2];
+			if (!is_global(*o, NULL)) {
+				continue;
+			}
+			s = o->symbol;
+			k = find_avail(s);
+			if (k < 0 && (reads_global(i, s) > 1 || (i->op != IR_CALL && !is_global(i->dst, s) && read_again(i, s)))) {
+				t = operand_temp(f, o->type);
+				ir_insert(i, ir_insn_make(IR_COPY, t, *o, operand_none()));
+				k = add_avail(s, t);
+			}
+			if (k >= 0) {
+				*o = avail[k].value;
+			}
+		}
+		if (i->op == IR_CALL) {
+			num_avail = 0;
+		} else if (is_global(i->dst, NULL)) {
+			s = i->dst.symbol;
+			if ((k = find_avail(s)) >= 0) {
+				avail[k] = avail[--num_avail];
+			}
+			if (read_again(i, s)) {
+				t = operand_temp(f, i->dst.type);
+				store = ir_insn_make(IR_COPY, i->dst, t, operand_none());
+				i->dst = t;
+				ir_insert(i->next, store);
+				add_avail(s, t);
+				i = store;
+			}
+		}
+	}
+}
+
+static int commutes(enum ir_op op)
+{
+	return op == IR_ADD || op == IR_MUL || op == IR_EQ || op == IR_NE;
+}
+
+static int operand_key(char *s, struct operand o)
+{
+	switch (o.kind) {
+	case OPERAND_NONE:
+		return 0;
+	case OPERAND_TEMP:
+		return sprintf(s, " %%%d", o.value);
+	case OPERAND_CONST:
+		return sprintf(s, " %d", o.value);
+	case OPERAND_STRING:
+		return sprintf(s, " s%d", o.value);
+	default:
+		return -1;
+	}
+}
+
+/* what i computes, as a key into values, or NULL if it reads memory */
+static const char *make_key(struct ir_insn *i)
+{
+	struct operand a = i->src[0], b = i->src[1], o;
+	size_t need = 64 + 16 * (size_t)i->num_args;
+	int n, k, len;
+	if (need > key_size) {
+		key_size = need;
+		key = realloc(key, key_size);
+	}
+	if (commutes(i->op) && (a.kind > b.kind || (a.kind == b.kind && a.value > b.value))) {
+		o = a;
+		a = b;
+		b = o;
+	}
+	len = sprintf(key, "%d %d", i->op, i->dst.type);
+	if (i->op == IR_PHI) {
+		len += sprintf(key + len, " b%d", i->block->id);
+	}
+	for (n = 0; n < 2 + i->num_args; ++n) {
+		k = operand_key(key + len, n == 0 ? a : n == 1 ? b : i->args[n - 2]);
+		if (k < 0) {
+			return NULL;
+		}
+		len += k;
+	}
+	return key;
+}
+
+static int numbered(enum ir_op op)
+{
+	switch (op) {
+	case IR_COPY:
+	case IR_CALL:
+	case IR_PRINT:
+	case IR_RETURN:
+	case IR_JUMP:
+	case IR_BRANCH:
+		return 0;
+	default:
+		return 1;
+	}
+}
+
+static void number_block(struct block *b)
+{
+	struct ir_insn *i, *next, *found;
+	struct operand v;
+	const char *k;
+	int n, mark = num_keys;
+	for (i = b->first; i; i = next) {
+		next = i->next;
+		i->src[0] = forwarded(i->src[0]);
+		i->src[1] = forwarded(i->src[1]);
+		for (n = 0; n < i->num_args; ++n) {
+			i->args[n] = forwarded(i->args[n]);
+		}
+		if (i->dst.kind != OPERAND_TEMP) {
+			continue;
+		}
+		if (i->op == IR_COPY && i->src[0].kind != OPERAND_VAR) {
+			forward[i->dst.value] = i->src[0];
+			ir_remove(i);
+			continue;
+		}
+		if (i->op == IR_PHI && trivial_phi(i, &v)) {
+			forward[i->dst.value] = v;
+			ir_remove(i);
+			continue;
+		}
+		if (!numbered(i->op) || !(k = make_key(i))) {
+			continue;
+		}
+		if ((found = hash_table_lookup(values, k))) {
+			forward[i->dst.value] = found->dst;
+			ir_remove(i);
+			continue;
+		}
+		hash_table_insert(values, k, i, NULL);
+		if (num_keys == max_keys) {
+			max_keys = max_keys ? max_keys * 2 : 64;
+			keys = realloc(keys, max_keys * sizeof(char *));
+		}
+		keys[num_keys] = malloc(strlen(k) + 1);
+		strcpy(keys[num_keys++], k);
+	}
+	for (n = 0; n < num_children[b->id]; ++n) {
+		number_block(children[b->id][n]);
+	}
+	while (num_keys > mark) {
+		--num_keys;
+		hash_table_remove(values, keys[num_keys]);
+		free(keys[num_keys]);
+	}
+}
+
+void gvn_func(struct ir_func *f)
+{
+	struct block *b;
+	struct ir_insn *i;
+	int n;
+	for (b = f->entry; b; b = b->next) {
+		local_globals(f, b);
+	}
+	free(avail);
+	avail = NULL;
+	
+	forward = malloc((f->num_temps + 1) * sizeof(struct operand));
+	for (n = 0; n < f->num_temps; ++n) {
+		forward[n] = operand_none();
+		forward[n].kind = OPERAND_TEMP;
+		forward[n].value = n;
+	}
+	dominance(f);
+	values = hash_table_create(0, 0);
+	number_block(f->entry);
+	/* phi args along back edges were numbered after the phi */
+	for (b = f->entry; b; b = b->next) {
+		for (i = b->first; i; i = i->next) {
+			for (n = 0; n < i->num_args; ++n) {
+				i->args[n] = forwarded(i->args[n]);
+			}
+		}
+	}
+	hash_table_delete(values);
+	free_dominance(f);
+	free(forward);
+	free(keys);
+	free(key);
+	keys = NULL;
+	key = NULL;
+	max_keys = 0;
+	key_size = 0;
+	ir_renumber(f);
+}
+
+/*
+out of ssa after Budimlic et al.: a phi's args and a copy's source are given the name of its
+destination unless their live ranges interfere, which takes most copies away. whatever still
+differs along an edge is copied in at its end, as one parallel copy, on an edge split in two if
+its source block also branches elsewhere.
+*/
+static char **live_in;
+static char **live_out;
+static struct block **def_block;
+static int *def_index;
+static int *parent;
+static int *next_member;
+
+static void liveness(struct ir_func *f)
+{
+	struct block *b, *s;
+	struct ir_insn *i;
+	char **uses = malloc(f->num_blocks * sizeof(char *)), **defs = malloc(f->num_blocks * sizeof(char *));
+	int n, k, t, changed = 1, index;
+	live_in = malloc(f->num_blocks * sizeof(char *));
+	live_out = malloc(f->num_blocks * sizeof(char *));
+	def_block = calloc(f->num_temps + 1, sizeof(struct block *));
+	def_index = calloc(f->num_temps + 1, sizeof(int));
+	for (b = f->entry; b; b = b->next) {
+		live_in[b->id] = calloc(f->num_temps + 1, 1);
+		live_out[b->id] = calloc(f->num_temps + 1, 1);
+		uses[b->id] = calloc(f->num_temps + 1, 1);
+		defs[b->id] = calloc(f->num_temps + 1, 1);
+		for (i = b->first, index = 0; i; i = i->next, ++index) {
+			if (i->op != IR_PHI) {
+				for (n = 0; n < 2 + i->num_args; ++n) {
+					t = n < 2 ? i->src[n].kind == OPERAND_TEMP ? i->src[n].value : -1 :
+					    i->args[n - 2].kind == OPERAND_TEMP ? i->args[n - 2].value : -1;
+					if (t >= 0 && !defs[b->id][t]) {
+						uses[b->id][t] = 1;
+					}
+				}
+			}
+			if (i->dst.kind == OPERAND_TEMP) {
+				t = i->dst.value;
+				defs[b->id][t] = 1;
+				def_block[t] = b;
+				def_index[t] = i->op == IR_PHI ? -1 : index;
+			}
+		}
+	}
+	while (changed) {
+		changed = 0;
+		for (b = f->entry; b; b = b->next) {
+			for (n = 0; n < block_num_succs(b); ++n) {
+				s = b->succ[n];
+				for (t = 0; t < f->num_temps; ++t) {
+					if (live_in[s->id][t] && !live_out[b->id][t]) {
+						live_out[b->id][t] = changed = 1;
+					}
+				}
+				k = pred_index(s, b);
+				for (i = s->first; i && i->op == IR_PHI; i = i->next) {
+					t = i->args[k].kind == OPERAND_TEMP ? i->args[k].value : -1;
+					if (t >= 0 && !live_out[b->id][t]) {
+						live_out[b->id][t] = changed = 1;
+					}
+				}
+			}
+			for (t = 0; t < f->num_temps; ++t) {
+				if (!live_in[b->id][t] && (uses[b->id][t] || (live_out[b->id][t] && !defs[b->id][t]))) {
+					live_in[b->id][t] = changed = 1;
+				}
+			}
+		}
+	}
+	for (n = 0; n < f->num_blocks; ++n) {
+		free(uses[n]);
+		free(defs[n]);
+	}
+	free(uses);
+	free(defs);
+}
+
+static int reads(struct ir_insn *i, int t)
+{
+	int n;
+	for (n = 0; n < 2; ++n) {
+		if (i->src[n].kind == OPERAND_TEMP && i->src[n].value == t) {
+			return 1;
+		}
+	}
+	for (n = 0; n < i->num_args; ++n) {
+		if (i->args[n].kind == OPERAND_TEMP && i->args[n].value == t) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* whether x is live just after the insn at index k of b, -1 being
+   after b's phis */
+static int live_after(int x, struct block *b, int k)
+{
+	struct ir_insn *i;
+	int index;
+	if (!def_block[x] || (def_block[x] == b && def_index[x] > k)) {
+		return 0;
+	}
+	if (live_out[b->id][x]) {
+		return 1;
+	}
+	for (i = b->first, index = 0; i; i = i->next, ++index) {
+		if (index > k && i->op != IR_PHI && reads(i, x)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static int find(int t)
+{
+	while (parent[t] != t) {
+		t = parent[t] = parent[parent[t]];
+	}
+	return t;
+}
+
+static int interfere(int a, int b)
+{
+	int x, y;
+	for (x = a; x >= 0; x = next_member[x]) {
+		for (y = b; y >= 0; y = next_member[y]) {
+			if ((def_block[y] && live_after(x, def_block[y], def_index[y])) ||
+			    (def_block[x] && live_after(y, def_block[x], def_index[x]))) {
+				return 1;
+			}
+		}
+	}
+	return 0;
+}
+
+static void coalesce(struct operand d, struct operand s)
+{
+	int a, b, t;
+	if (d.kind != OPERAND_TEMP || s.kind != OPERAND_TEMP) {
+		return;
+	}
+	a = find(d.value);
+	b = find(s.value);
+	if (a == b || interfere(a, b)) {
+		return;
+	}
+	/* b's members join a's list */
+	for (t = a; next_member[t] >= 0; t = next_member[t]);
+	next_member[t] = b;
+	parent[b] = a;
+}
+
+static void rename_temp(struct operand *o)
+{
+	if (o->kind == OPERAND_TEMP) {
+		o->value = find(o->value);
+	}
+}
+
+struct copy {
+	struct operand dst;
+	struct operand src;
+};
+
+/* emits the copies, all at once in effect, ahead of before */
+static void parallel_copy(struct ir_func *f, struct copy *copies, int num, struct ir_insn *before)
+{
+	struct operand t;
+	int n, k, blocked, done = 0;
+	while (done < num) {
+		for (n = 0; n < num; ++n) {
+			if (copies[n].dst.kind == OPERAND_NONE) {
+				continue;
+			}
+			for (k = 0, blocked = 0; k < num && !blocked; ++k) {
+				blocked = k != n && copies[k].dst.kind != OPERAND_NONE &&
+				          operand_eq(copies[k].src, copies[n].dst);
+			}
+			if (!blocked) {
+				break;
+			}
+		}
+		if (n == num) {
+			/* a cycle: park one destination's value and read that instead */
+			for (n = 0; copies[n].dst.kind == OPERAND_NONE; ++n);
+			t = operand_temp(f, copies[n].dst.type);
+			ir_insert(before, ir_insn_make(IR_COPY, t, copies[n].dst, operand_none()));
+			for (k = 0; k < num; ++k) {
+				if (operand_eq(copies[k].src, copies[n].dst)) {
+					copies[k].src = t;
+				}
+			}
+			continue;
+		}
+		ir_insert(before, ir_insn_make(IR_COPY, copies[n].dst, copies[n].src, operand_none()));
+		copies[n].dst = operand_none();
+		++done;
+	}
+}
+
+/* a block of its own on the edge from pred into b, laid out after pred */
+static struct block *split_edge(struct ir_func *f, struct block *pred, struct block *b)
+{
+	struct block *s = block_make(f);
+	ir_append(s, ir_insn_make(IR_JUMP, operand_none(), operand_none(), operand_none()));
+	s->succ[0] = b;
+	s->preds = malloc(sizeof(struct block *));
+	s->preds[0] = pred;
+	s->num_preds = 1;
+	pred->succ[pred->succ[0] == b ? 0 : 1] = s;
+	b->preds[pred_index(b, pred)] = s;
+	s->next = pred->next;
+	pred->next = s;
+	return s;
+}
+
+static void resolve_phis(struct ir_func *f, struct block *b)
+{
+	struct ir_insn *i, *next;
+	struct block *pred;
+	struct copy *copies = NULL;
+	int n, num;
+	for (n = 0; n < b->num_preds; ++n) {
+		num = 0;
+		for (i = b->first; i && i->op == IR_PHI; i = i->next) {
+			if (!operand_eq(i->dst, i->args[n])) {
+				copies = realloc(copies, (num + 1) * sizeof(struct copy));
+				copies[num].dst = i->dst;
+				copies[num++].src = i->args[n];
+			}
+		}
+		if (num == 0) {
+			continue;
+		}
+		pred = b->preds[n];
+		if (block_num_succs(pred) > 1) {
+			pred = split_edge(f, pred, b);
+		}
+		parallel_copy(f, copies, num, pred->last);
+	}
+	for (i = b->first; i && i->op == IR_PHI; i = next) {
+		next = i->next;
+		ir_remove(i);
+	}
+	free(copies);
+}
+
+void unssa_func(struct ir_func *f)
+{
+	struct block *b;
+	struct ir_insn *i, *next;
+	int n, num_temps = f->num_temps, num_blocks = f->num_blocks;
+	liveness(f);
+	parent = malloc((num_temps + 1) * sizeof(int));
+	next_member = malloc((num_temps + 1) * sizeof(int));
+	for (n = 0; n < num_temps; ++n) {
+		parent[n] = n;
+		next_member[n] = -1;
+	}
+	for (b = f->entry; b; b = b->next) {
+		for (i = b->first; i && i->op == IR_PHI; i = i->next) {
+			for (n = 0; n < i->num_args; ++n) {
+				coalesce(i->dst, i->args[n]);
+			}
+		}
+	}
+	for (b = f->entry; b; b = b->next) {
+		for (i = b->first; i; i = i->next) {
+			if (i->op == IR_COPY) {
+				coalesce(i->dst, i->src[0]);
+			}
+		}
+	}
+	
+	for (b = f->entry; b; b = b->next) {
+		for (i = b->first; i; i = next) {
+			next = i->next;
+			rename_temp(&i->dst);
+			rename_temp(&i->src[0]);
+			rename_temp(&i->src[1]);
+			for (n = 0; n < i->num_args; ++n) {
+				rename_temp(&i->args[n]);
+			}
+			if (i->op == IR_COPY && operand_eq(i->dst, i->src[0])) {
+				ir_remove(i);
+			}
+		}
+	}
+	for (b = f->entry; b; b = b->next) {
+		resolve_phis(f, b);
+	}
+	
+	for (n = 0; n < num_blocks; ++n) {
+		free(live_in[n]);
+		free(live_out[n]);
+	}
+	free(live_in);
+	free(live_out);
+	free(def_block);
+	free(def_index);
+	free(parent);
+	free(next_member);
+	ir_cfg(f);
+	ir_renumber(f);
+}
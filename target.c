@@ -0,0 +1,110 @@
+#include <stdlib.h>
+#include <string.h>
+#include "ast.h"
+
+static const enum reg i386_regs[] = {
+	REG_ECX, REG_EDX, REG_EBX, REG_ESI, REG_EDI
+};
+
+/* calls to internal functions only; everything else is plain cdecl */
+static const enum reg i386_arg_regs[] = {
+	REG_ECX, REG_EDX
+};
+
+const struct target target_i386 = {
+	"i386",
+	i386_regs, 5,
+	REG_CALLER_SAVED,
+	REG_CALLEE_SAVED,
+	i386_arg_regs, 2,
+	1
+};
+
+/* %rax holds results and dividends, %rbp and %rsp the frame */
+static const enum reg x86_64_regs[] = {
+	REG_R10, REG_R11, REG_R8, REG_R9, REG_ECX, REG_EDX, REG_ESI, REG_EDI,
+	REG_EBX, REG_R12, REG_R13, REG_R14, REG_R15
+};
+
+/* System V */
+static const enum reg x86_64_arg_regs[] = {
+	REG_EDI, REG_ESI, REG_EDX, REG_ECX, REG_R8, REG_R9
+};
+
+const struct target target_x86_64 = {
+	"x86_64",
+	x86_64_regs, 13,
+	REG_ECX | REG_EDX | REG_ESI | REG_EDI | REG_R8 | REG_R9 | REG_R10 | REG_R11,
+	REG_EBX | REG_R12 | REG_R13 | REG_R14 | REG_R15,
+	x86_64_arg_regs, 6,
+	0
+};
+
+const struct target *target_from_s(const char *name)
+{
+	if (!strcmp(name, "i386")) {
+		return &target_i386;
+	} else if (!strcmp(name, "x86_64")) {
+		return &target_x86_64;
+	} else {
+		return NULL;
+	}
+}
+
+/* the register a call to func passes arg i in, or 0 for the stack */
+enum reg arg_reg(const struct target *target, struct symbol *func, int i)
+{
+	if ((target->local_args && !func->internal) || i >= target->num_arg_regs) {
+		return 0;
+	}
+	return target->arg_regs[i];
+}
+
+/* k if c is 2^k, otherwise -1 */
+int log2_exact(unsigned c)
+{
+	int k = 0;
+	if (!c || (c & (c - 1))) {
+		return -1;
+	}
+	while (c >>= 1) {
+		++k;
+	}
+	return k;
+}
+
+/* d must be at least 3 and not a power of two (Granlund and Montgomery) */
+void div_magic(unsigned d, struct div_magic *m)
+{
+	unsigned long long mul;
+	int p, l = 0;
+	for (p = 32; p < 64; ++p) {
+		mul = (1ULL << p) / d + 1;
+		if (mul * d - (1ULL << p) <= 1ULL << (p - 32)) {
+			break;
+		}
+	}
+	if (mul < 1ULL << 32) {
+		m->mul = mul;
+		m->add = 0;
+		m->shift = p - 32;
+		return;
+	}
+	while ((1U << l) < d) {
+		++l;
+	}
+	m->mul = (1ULL << (32 + l)) / d + 1 - (1ULL << 32);
+	m->add = 1;
+	m->shift = l - 1;
+}
+
+/* the inverse of odd d modulo 2^32; each step doubles the correct bits */
+unsigned mod_inverse(unsigned d)
+{
+	unsigned x = d;
+	int i;
+	for (i = 0; i < 4; ++i) {
+		x *= 2 - d * x;
+	}
+	return x;
+}